@@ -0,0 +1,487 @@
+#include "bench.h"
+
+#include <cfloat>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <random>
+
+#include "image.h"
+#include "image_store.h"
+#include "integral.h"
+#include "learner.h"
+#include "model.h"
+#include "runtime.h"
+
+#define BENCH_IMAGE_PATH "../dataset/solvay-conference.jpg"
+#define BENCH_CLASSIFIER_DIR "../classifiers/paper_impl"
+
+template<typename F>
+double
+time_ms(int reps, F fn) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < reps; ++i) {
+        fn();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / reps;
+}
+
+/**
+ * @brief The original Img::toIntegral, reading three neighbours of the output per pixel.
+ */
+ImgType
+reference_integral(const ImgType &img) {
+    ImgType integral(img.height + 1, img.width + 1);
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            integral[y + 1][x + 1] = img[y][x] + integral[y][x + 1] + integral[y + 1][x] - integral[y][x];
+        }
+    }
+    return integral;
+}
+
+Img<uchar>
+bench_frame(const cv::Mat &photo, int height, int width) {
+    Img<uchar> gray(height, width);
+    if (!photo.empty()) {
+        gray.loadGrayScale(photo);
+        return gray;
+    }
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> distrib(0, 255);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            gray[y][x] = (uchar) distrib(gen);
+        }
+    }
+    return gray;
+}
+
+int
+bench_integral() {
+    const int REPS = 50;
+    const Scale SIZES[] = {{IM_WIDTH, IM_HEIGHT},
+                           {1600,     806}};
+    const IntegralIsa ISAS[] = {IsaScalar, IsaSse2, IsaAvx2};
+
+    cv::Mat photo = cv::imread(BENCH_IMAGE_PATH, cv::IMREAD_COLOR);
+    if (photo.empty()) {
+        printf("Could not open %s, using random pixels.\n", BENCH_IMAGE_PATH);
+    }
+
+    const IntegralIsa best = integral_isa();
+    bool failed = false;
+    for (const auto &size: SIZES) {
+        Img<uchar> gray = bench_frame(photo, size.height, size.width);
+        ImgType dbl = gray.cast<ImgFlt>();
+        Img<float> flt = gray.cast<float>();
+
+        // The double and uint32 sums of 8-bit pixels are exact. The float sums round once they pass 2^24, at most
+        // once per row and column step on the way to a corner.
+        const double float_tolerance = (size.width + size.height) * FLT_EPSILON;
+        ImgType squares = dbl;
+        for (auto &v: squares.data) v *= v;
+        ImgType expected = reference_integral(dbl);
+        ImgType expected_sq = reference_integral(squares);
+        double reference = time_ms(REPS, [&]() { reference_integral(dbl); });
+        printf("%dx%d\n", size.width, size.height);
+        printf("\t%-8s double       %8.3fms\n", "original", reference);
+
+        ImgType sum(size.height + 1, size.width + 1);
+        ImgType sqsum(size.height + 1, size.width + 1);
+        Img<float> sum_f(size.height + 1, size.width + 1);
+        Img<float> sqsum_f(size.height + 1, size.width + 1);
+        vec<uint32_t> sum_u32((size.height + 1) * (size.width + 1));
+        const size_t u32_stride = size.width + 1;
+
+        for (IntegralIsa isa: ISAS) {
+            set_integral_isa(isa);
+            if (integral_isa() != isa) continue;
+            const char *name = integral_isa_name(isa);
+
+            double max_err = 0, max_rel_err = 0;
+            auto check = [&](const ImgType &expect, auto at, double &err, bool relative) {
+                for (int y = 0; y <= size.height; ++y) {
+                    for (int x = 0; x <= size.width; ++x) {
+                        double diff = std::abs((double) at(y, x) - expect[y][x]);
+                        err = std::max(err, relative ? diff / std::max(1.0, expect[y][x]) : diff);
+                    }
+                }
+            };
+            auto at_sum = [&](int y, int x) { return sum[y][x]; };
+            auto at_sqsum = [&](int y, int x) { return sqsum[y][x]; };
+            auto at_sum_f = [&](int y, int x) { return sum_f[y][x]; };
+            auto at_sqsum_f = [&](int y, int x) { return sqsum_f[y][x]; };
+            auto at_sum_u32 = [&](int y, int x) { return sum_u32[y * u32_stride + x]; };
+
+            double t_dbl = time_ms(REPS, [&]() {
+                integral(dbl.data.data(), dbl.stride, dbl.height, dbl.width, sum.data.data(), sum.stride);
+            });
+            check(expected, at_sum, max_err, false);
+            double t_dbl_sq = time_ms(REPS, [&]() {
+                integral(dbl.data.data(), dbl.stride, dbl.height, dbl.width, sum.data.data(), sum.stride,
+                         sqsum.data.data(), sqsum.stride);
+            });
+            check(expected, at_sum, max_err, false);
+            check(expected_sq, at_sqsum, max_err, false);
+            double t_flt = time_ms(REPS, [&]() {
+                integral(flt.data.data(), flt.stride, flt.height, flt.width, sum_f.data.data(), sum_f.stride);
+            });
+            check(expected, at_sum_f, max_rel_err, true);
+            double t_flt_sq = time_ms(REPS, [&]() {
+                integral(flt.data.data(), flt.stride, flt.height, flt.width, sum_f.data.data(), sum_f.stride,
+                         sqsum_f.data.data(), sqsum_f.stride);
+            });
+            check(expected, at_sum_f, max_rel_err, true);
+            check(expected_sq, at_sqsum_f, max_rel_err, true);
+            double t_u32 = time_ms(REPS, [&]() {
+                integral(gray.data.data(), gray.stride, gray.height, gray.width, sum_u32.data(), u32_stride);
+            });
+            check(expected, at_sum_u32, max_err, false);
+            double t_u32_sq = time_ms(REPS, [&]() {
+                integral(gray.data.data(), gray.stride, gray.height, gray.width, sum_u32.data(), u32_stride,
+                         sqsum.data.data(), sqsum.stride);
+            });
+            check(expected, at_sum_u32, max_err, false);
+            check(expected_sq, at_sqsum, max_err, false);
+            const bool ok = max_err == 0 && max_rel_err <= float_tolerance;
+            failed |= !ok;
+
+            printf("\t%-8s double       %8.3fms (%5.2fx)\n", name, t_dbl, reference / t_dbl);
+            printf("\t%-8s double + sq  %8.3fms (%5.2fx)\n", name, t_dbl_sq, reference / t_dbl_sq);
+            printf("\t%-8s float        %8.3fms (%5.2fx)\n", name, t_flt, reference / t_flt);
+            printf("\t%-8s float + sq   %8.3fms (%5.2fx)\n", name, t_flt_sq, reference / t_flt_sq);
+            printf("\t%-8s uint32       %8.3fms (%5.2fx)\n", name, t_u32, reference / t_u32);
+            printf("\t%-8s uint32 + sq  %8.3fms (%5.2fx)\n", name, t_u32_sq, reference / t_u32_sq);
+            printf("\t%-8s max error vs original: %g, float relative %g%s\n", name, max_err, max_rel_err,
+                   ok ? "" : " TOO LARGE");
+        }
+    }
+    set_integral_isa(best);
+    return failed ? 1 : 0;
+}
+
+typedef struct {
+    size_t windows;
+    size_t accepted;        // by the scalar interpreter
+    size_t mismatches;      // windows decided differently, plus batches that evaluated another number of features
+} KernelCheck;
+
+/**
+ * @brief Run every window that the Runtime hands to runBatch() (stride 1, every scale that fits) through the selected
+ * kernel and, one by one, through the scalar CascadeProgram::run(), and compare the decisions and features evaluated.
+ */
+KernelCheck
+check_kernel(const vec<classifiervec> &cascade, const fltvec &thresholds, int windowSize, const ImgType &integral,
+             const ImgType &squared, bool soft) {
+    KernelCheck check{0, 0, 0};
+    const int batch = CascadeProgram::batchSize();
+    for (flt scale = 1.0;; scale *= SCALE_FACTOR) {
+        int size = scaleUp(windowSize, scale);
+        if (size >= integral.height || size >= integral.width) break;
+        int step = std::max(1, (int) std::lround(scale));
+        CascadeProgram program(cascade, thresholds, windowSize, scale, step, integral.stride);
+        for (int top = 0; top + size < integral.height; top += step) {
+            for (int left = 0; left + (batch - 1) * step + size < integral.width; left += batch * step) {
+                size_t vector_features = 0;
+                size_t scalar_features = 0;
+                uint32_t accepted = program.runBatch(integral.row(top) + left, squared.row(top) + left, soft,
+                                                     vector_features);
+                for (int i = 0; i < batch; ++i) {
+                    const ImgFlt *window = integral.row(top) + left + i * step;
+                    Stats stats = program.windowStats(window, squared.row(top) + left + i * step);
+                    bool expected = program.run(window, stats, soft, scalar_features);
+                    check.windows++;
+                    check.accepted += expected;
+                    check.mismatches += expected != (bool) (accepted >> i & 1);
+                }
+                check.mismatches += vector_features != scalar_features;
+            }
+        }
+    }
+    return check;
+}
+
+int
+bench_detector() {
+    const int REPS = 5;
+    const Scale SIZES[] = {{IM_WIDTH, IM_HEIGHT},
+                           {1600,     806}};
+    const ProgramIsa ISAS[] = {ProgramScalar, ProgramAvx2, ProgramAvx512};
+    const flt LOOSE_THRESHOLD = 0.3;    // every stage, so that many windows reach the last one
+
+    auto model = CascadeModel::openConverted(BENCH_CLASSIFIER_DIR);
+    const vec<classifiervec> cascade = model->cascade();
+    const fltvec trained = model->thresholds();
+    const fltvec loose(cascade.size(), LOOSE_THRESHOLD);
+    cv::Mat photo = cv::imread(BENCH_IMAGE_PATH, cv::IMREAD_COLOR);
+    if (photo.empty()) {
+        printf("Could not open %s, using random pixels.\n", BENCH_IMAGE_PATH);
+    }
+
+    const ProgramIsa best = program_isa();
+    bool identical = true;
+    for (const auto &size: SIZES) {
+        ImgType gray = bench_frame(photo, size.height, size.width).cast<ImgFlt>();
+        ImgType squared(0, 0);
+        ImgType integral = gray.toIntegral(squared);
+
+        printf("%dx%d\n", size.width, size.height);
+        for (bool soft: {false, true}) {
+            Runtime runtime(*model, {SCALE_FACTOR, 1.0, 4, soft, ScanScaledFeatures}, size);
+            double scalar = 0;
+            for (ProgramIsa isa: ISAS) {
+                set_program_isa(isa);
+                if (program_isa() != isa) continue;
+                boxes found;
+                ScanCount count{};
+                double t = time_ms(REPS, [&]() { found = runtime.run(integral, squared, count); });
+                if (isa == ProgramScalar) scalar = t;
+                printf("\t%-8s %-4s cascade %8.2fms (%5.2fx), %zu detections", program_isa_name(isa),
+                       soft ? "soft" : "hard", t, scalar / t, found.size());
+                if (isa == ProgramScalar) {
+                    printf("\n");
+                    continue;
+                }
+                // Check the kernel window by window, with the model's thresholds and with ones that accept plenty.
+                for (const fltvec *thresholds: {&trained, &loose}) {
+                    KernelCheck check = check_kernel(cascade, *thresholds, model->windowSize(), integral, squared,
+                                                     soft);
+                    identical = identical && check.mismatches == 0;
+                    printf(", %zu/%zu accepted%s", check.accepted, check.windows,
+                           check.mismatches ? " DIFFERENT FROM SCALAR" : "");
+                }
+                printf("\n");
+            }
+        }
+    }
+    set_program_isa(best);
+
+    if (!identical) {
+        printf("The vector kernels do not decide every window like the scalar one.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether square boxes `a` and `b` overlap by at least half of their union.
+ */
+bool
+overlaps(const std::tuple<XY, XY> &a, const std::tuple<XY, XY> &b) {
+    auto [ax, ay] = std::get<0>(a);
+    auto [bx, by] = std::get<0>(b);
+    int as = std::get<1>(a).x;
+    int bs = std::get<1>(b).x;
+    int w = std::min(ax + as, bx + bs) - std::max(ax, bx);
+    int h = std::min(ay + as, by + bs) - std::max(ay, by);
+    if (w <= 0 || h <= 0) return false;
+    double overlap = (double) w * h;
+    return overlap / ((double) as * as + (double) bs * bs - overlap) >= 0.5;
+}
+
+/**
+ * @brief Fraction of `found` that overlaps a box of `reference` by at least half of their union.
+ */
+double
+matched(const boxes &found, const boxes &reference) {
+    if (found.empty()) return 1.0;
+    size_t hits = 0;
+    for (const auto &f: found) {
+        for (const auto &r: reference) {
+            if (overlaps(f, r)) {
+                hits++;
+                break;
+            }
+        }
+    }
+    return (double) hits / (double) found.size();
+}
+
+typedef struct {
+    size_t faces;
+    size_t detected;        // faces overlapped by a detection, see overlaps()
+    size_t windows;         // scanned on the backgrounds
+    size_t falsePositives;  // detections on the backgrounds
+} Quality;
+
+/**
+ * @brief Detection rate of `mode` on `faces`, each scaled to every size of `faceSizes` and scanned as a frame of its
+ * own, and its false positives on `backgrounds`, which hold no faces.
+ */
+Quality
+detection_quality(const CascadeModel &model, ScanMode mode, images &faces, const vec<int> &faceSizes,
+                  const images &backgrounds) {
+    const ScanOptions options = {SCALE_FACTOR, 1.0, 4, true, mode};
+    Quality quality{0, 0, 0, 0};
+    ScanCount count{};
+    for (int size: faceSizes) {
+        Runtime runtime(model, options, {size, size});
+        const std::tuple<XY, XY> truth = {{0, 0}, {size, size}};
+        for (auto &face: faces) {
+            ImgType squared(0, 0);
+            ImgType integral = face.resize(size, size).toIntegral(squared);
+            boxes found = runtime.run(integral, squared, count);
+            quality.faces++;
+            quality.detected += std::any_of(found.begin(), found.end(), [&](const auto &b) {
+                return overlaps(b, truth);
+            });
+        }
+    }
+
+    Runtime runtime(model, options);
+    for (const auto &background: backgrounds) {
+        ImgType squared(0, 0);
+        ImgType integral = background.toIntegral(squared);
+        quality.falsePositives += runtime.run(integral, squared, count).size();
+        quality.windows += count.windows;
+    }
+    return quality;
+}
+
+int
+bench_pyramid() {
+    const int REPS = 5;
+    const Scale SIZES[] = {{IM_WIDTH, IM_HEIGHT},
+                           {1600,     806}};
+    const size_t FACE_COUNT = 1000;
+    const vec<int> FACE_SIZES = {FEATURE_SIZE, 40, 64};
+    const size_t BG_COUNT = 100;             // whole frames, see StoreFrames
+
+    auto model = CascadeModel::openConverted(BENCH_CLASSIFIER_DIR);
+    cv::Mat photo = cv::imread(BENCH_IMAGE_PATH, cv::IMREAD_COLOR);
+    if (photo.empty()) {
+        printf("Could not open %s, using random pixels.\n", BENCH_IMAGE_PATH);
+    }
+
+    for (const auto &size: SIZES) {
+        ImgType gray = bench_frame(photo, size.height, size.width).cast<ImgFlt>();
+        ImgType squared(0, 0);
+        ImgType integral = gray.toIntegral(squared);
+
+        Runtime scaled(*model, {SCALE_FACTOR, 1.0, 4, true, ScanScaledFeatures}, size);
+        Runtime pyramid(*model, {SCALE_FACTOR, 1.0, 4, true, ScanPyramid}, size);
+        // The first pyramid scan allocates the arena that later frames reuse.
+        boxes by_scaled = scaled.run(integral, squared);
+        boxes by_pyramid = pyramid.run(integral, squared);
+        double t_scaled = time_ms(REPS, [&]() { by_scaled = scaled.run(integral, squared); });
+        double t_pyramid = time_ms(REPS, [&]() { by_pyramid = pyramid.run(integral, squared); });
+
+        printf("%dx%d\n", size.width, size.height);
+        printf("\t%-16s %8.2fms %6.1f frames/s, %zu detections, %5.1f%% found by pyramid\n", "scaled features",
+               t_scaled, 1000.0 / t_scaled, by_scaled.size(), 100.0 * matched(by_scaled, by_pyramid));
+        printf("\t%-16s %8.2fms %6.1f frames/s, %zu detections, %5.1f%% found by scaled features\n", "pyramid",
+               t_pyramid, 1000.0 / t_pyramid, by_pyramid.size(), 100.0 * matched(by_pyramid, by_scaled));
+    }
+
+    if (!std::filesystem::exists(FP_FACES_DIR) || !std::filesystem::exists(FP_BGS_DIR)) {
+        printf("Could not find %s and %s, no detection rates.\n", FP_FACES_DIR, FP_BGS_DIR);
+        return 1;
+    }
+    // The first images of both sets, so every run measures the same ones.
+    auto face_store = ImageStore::loadOrBuild(CACHE_DIR, list_dir(FP_FACES_DIR), StoreFaces);
+    auto frame_store = ImageStore::loadOrBuild(CACHE_DIR, list_dir(FP_BGS_DIR), StoreFrames);
+    images faces;
+    for (size_t i = 0; i < std::min(FACE_COUNT, face_store->size()); ++i) {
+        faces.push_back(face_store->image(i));
+    }
+    images backgrounds;
+    for (size_t i = 0; i < std::min(BG_COUNT, frame_store->size()); ++i) {
+        backgrounds.push_back(frame_store->image(i));
+    }
+
+    printf("%zu faces at %zu sizes, %zu background frames\n", faces.size(), FACE_SIZES.size(), backgrounds.size());
+    for (ScanMode mode: {ScanScaledFeatures, ScanPyramid}) {
+        Quality q = detection_quality(*model, mode, faces, FACE_SIZES, backgrounds);
+        printf("\t%-16s detection rate %5.1f%% (%zu/%zu), %.2e false positives per window (%zu in %zu windows)\n",
+               mode == ScanPyramid ? "pyramid" : "scaled features",
+               q.faces ? 100.0 * (double) q.detected / (double) q.faces : 0.0, q.detected, q.faces,
+               q.windows ? (double) q.falsePositives / (double) q.windows : 0.0, q.falsePositives, q.windows);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Fraction of samples a strong classifier gets wrong, deciding faces at half the alpha sum.
+ */
+flt
+training_error(const SampleStore &store, const vec<int> &labels, const classifiervec &classifiers) {
+    FeatureTable table = Learner::compile(classifiers, store);
+    size_t wrong = 0;
+    for (size_t i = 0; i < store.size(); ++i) {
+        auto h = Learner::strongClassifier(store, i, classifiers, table);
+        int label = h.weightedSum >= 0.5 * h.alphaSum ? 1 : 0;
+        if (label != labels[i]) ++wrong;
+    }
+    return (flt) wrong / (flt) store.size();
+}
+
+int
+bench_threshold_search() {
+    const int FACE_COUNT = 1000;
+    const int BG_COUNT = 1000;
+    const int ROUNDS = 10;
+    const size_t FEATURE_STEP = 4;  // every 4th feature keeps the exact search to minutes
+    const ResponseFormat RESPONSE_FORMAT = ResponseFloat32;
+    const uint32_t BINS[] = {256, 64};
+
+    if (!std::filesystem::exists(FP_FACES_DIR) || !std::filesystem::exists(FP_BGS_DIR)) {
+        printf("Could not find %s and %s.\n", FP_FACES_DIR, FP_BGS_DIR);
+        return 1;
+    }
+    auto samples = sample_data(FACE_COUNT, BG_COUNT, list_dir(FP_FACES_DIR), list_dir(FP_BGS_DIR));
+    auto store = SampleStore::create(CACHE_DIR, SampleFloat64, samples.ims);
+
+    auto all = feature_vec(generate_features());
+    auto features = std::make_shared<vec<shdptr<Feature>>>();
+    for (size_t i = 0; i < all.size(); i += FEATURE_STEP) {
+        features->push_back(all[i]);
+    }
+    printf("%zu samples, %zu features, %d rounds\n", store->size(), features->size(), ROUNDS);
+
+    vec<uint32_t> columns(store->size());
+    std::iota(columns.begin(), columns.end(), 0);
+    FeatureTable table(*features, store->height(), store->width(), store->stride());
+    shdptr<ResponseMatrix> matrix;
+    double t_matrix = time_ms(1, [&]() {
+        matrix = ResponseMatrix::loadOrBuild(CACHE_DIR, table, *store, RESPONSE_FORMAT);
+    });
+
+    typedef struct {
+        std::string name;
+        double prepare;
+        double train;
+        flt error;
+    } Row;
+    vec<Row> rows;
+
+    auto run = [&](const std::string &name, double prepare, const std::function<void(Learner &)> &setup) {
+        Learner learner(store, columns, samples.labels, features);
+        learner.useResponses(matrix);
+        setup(learner);
+        double t = time_ms(1, [&]() { learner.train(ROUNDS); });
+        rows.push_back({name, prepare, t, training_error(*store, samples.labels, *learner.weakClassifiers)});
+    };
+
+    run("exact", 0, [](Learner &) {});
+
+    shdptr<SortedIndex> index;
+    double t_index = time_ms(1, [&]() { index = SortedIndex::loadOrBuild(CACHE_DIR, *matrix); });
+    run("sorted", t_index, [&](Learner &learner) { learner.useSortedIndex(index); });
+
+    for (uint32_t num_bins: BINS) {
+        shdptr<ResponseBins> bins;
+        double t_bins = time_ms(1, [&]() { bins = ResponseBins::loadOrBuild(CACHE_DIR, *matrix, num_bins); });
+        run("binned " + std::to_string(num_bins), t_bins, [&](Learner &learner) { learner.useBins(bins); });
+    }
+
+    printf("\nresponse matrix: %.0fms\n", t_matrix);
+    printf("%-12s %12s %12s %12s %10s\n", "search", "prepare", "train", "per round", "error");
+    for (const auto &row: rows) {
+        printf("%-12s %10.0fms %10.0fms %10.0fms %9.2f%%\n", row.name.c_str(), row.prepare, row.train,
+               row.train / ROUNDS, 100.0 * row.error);
+    }
+    return 0;
+}
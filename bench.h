@@ -0,0 +1,28 @@
+#pragma once
+
+/**
+ * @brief Compare the integral image kernels against the original scalar recurrence on IM_WIDTH x IM_HEIGHT and
+ * 1600x806 frames: timings of every output type and the largest error, absolute for the exact double and uint32
+ * sums and relative for the float ones. Returns 1 if an exact sum differs or a float sum is off by more than rounding.
+ */
+int bench_integral();
+
+/**
+ * @brief Scan IM_WIDTH x IM_HEIGHT and 1600x806 frames with every CascadeProgram kernel, with hard and soft stages,
+ * and check the vector kernels window by window against the scalar interpreter, with the model's thresholds and with
+ * loose ones that accept many windows. Returns 1 if a decision or a count of evaluated features differs.
+ */
+int bench_detector();
+
+/**
+ * @brief Scan IM_WIDTH x IM_HEIGHT and 1600x806 frames with scaled features and with an image pyramid, and compare the
+ * time per frame and how many detections of each mode the other one finds as well. Then measure the detection rate
+ * of both modes on the faces of FP_FACES_DIR, each scanned alone at a few sizes, and their false positives per window
+ * on the frames of FP_BGS_DIR.
+ */
+int bench_pyramid();
+
+/**
+ * @brief Train a few rounds with every ThresholdSearch on the same samples and compare wall time and training error.
+ */
+int bench_threshold_search();
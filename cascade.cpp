@@ -1,23 +1,27 @@
 #include "cascade.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
 #include <utility>
 
-AttentionalCascade::AttentionalCascade(vec<ImgType> ims,
+#include "model.h"
+
+AttentionalCascade::AttentionalCascade(images ims,
                                        vec<int> lbls,
                                        const Features &feats,
-                                       Stats stats,
-                                       Samples validation) {
-    integrals.reserve(ims.size());
-
-    for (int i = 0; i < ims.size(); ++i) {
-        auto im = &ims[i];
-        im->normalize(stats.mean, stats.std);
-        integrals.push_back(mkshd<ImgType>(im->toIntegral()));
-
+                                       Samples validation,
+                                       SampleFormat format) {
+    sampleFormat = format;
+    samples = SampleStore::create(CACHE_DIR, format, ims);
+    for (uint32_t i = 0; i < lbls.size(); ++i) {
         if (lbls[i] == 1) {
-            posIntegrals.push_back(integrals[i]);
+            posColumns.push_back(i);
         } else {
-            negIntegrals.push_back(integrals[i]);
+            negColumns.push_back(i);
         }
     }
 
@@ -25,11 +29,37 @@ AttentionalCascade::AttentionalCascade(vec<ImgType> ims,
     auto feat_vec = feature_vec(feats);
     features = mkshd<vec<shdptr<Feature>>>(feat_vec);
 
-    for (auto &im: validation.ims) {
-        im.normalize(stats.mean, stats.std);
-        validationIntegrals.push_back(mkshd<ImgType>(im.toIntegral()));
-    }
+    validationSamples = SampleStore::create(CACHE_DIR, format, validation.ims);
     validationLabels = std::move(validation.labels);
+    validationPassed.assign(validationLabels.size(), true);
+
+    negativeTarget = negColumns.size();
+}
+
+void
+AttentionalCascade::precomputeResponses(ResponseFormat format, ThresholdSearch search, uint32_t numBins) {
+    responseFormat = format;
+    responseSearch = search;
+    responseBins = numBins;
+    loadResponses(CACHE_DIR);
+}
+
+void
+AttentionalCascade::loadResponses(const std::string &dir) {
+    FeatureTable table(*features, samples->height(), samples->width(), samples->stride());
+    responses = ResponseMatrix::loadOrBuild(dir, table, *samples, responseFormat);
+    sorted = nullptr;
+    bins = nullptr;
+    if (responseSearch == SearchSorted) {
+        sorted = SortedIndex::loadOrBuild(dir, *responses);
+    } else if (responseSearch == SearchBinned) {
+        bins = ResponseBins::loadOrBuild(dir, *responses, responseBins);
+    }
+}
+
+void
+AttentionalCascade::useNegativeMining(const paths &backgrounds, const MiningOptions &options) {
+    miner = mkshd<NegativeMiner>(NegativeMiner(backgrounds, options));
 }
 
 vec<shdptr<classifiervec>>
@@ -47,8 +77,29 @@ AttentionalCascade::train(flt maxFalsePositive, flt minDetection, flt targetOver
     int i = 0;
     int n;
 
+    if (resumed) {
+        fPosVec = resumed->falsePositives;
+        mDecVec = resumed->detections;
+        thresholds = resumed->thresholds;
+        for (size_t k = 0; k < resumed->completed; ++k) {
+            char path[300];
+            snprintf(path, sizeof path, "%s/%zu.csv", checkpointDir.c_str(), k);
+            cascade.push_back(mkshd<classifiervec>(load_weak_classifiers(path)));
+            reduceValidation(*cascade.back(), thresholds[k + 1]);
+        }
+        i = (int) resumed->completed;
+        printf("Resuming after %zu stages and %zu weak classifiers of stage %d\n", resumed->completed,
+               resumed->stage.size(), i + 1);
+    }
+
     auto START_TIME = std::chrono::high_resolution_clock::now();
     while (fPosVec[i] > fPosTar) {
+        // Without negatives a stage has nothing to reject and would add weak classifiers forever.
+        if (negColumns.empty()) {
+            printf("No negative samples left%s, stopping after %zu stages at a false positive rate of %f\n",
+                   miner ? " and every background image was mined" : "", cascade.size(), fPosVec[i]);
+            break;
+        }
         i++;
 
         auto stage_start_time = std::chrono::high_resolution_clock::now();
@@ -58,28 +109,31 @@ AttentionalCascade::train(flt maxFalsePositive, flt minDetection, flt targetOver
         std::cout << std::endl;
 
         n = 0;
-        fPosVec.push_back(fPosVec[i - 1]);
-        mDecVec.push_back(mDecVec[i - 1]);
-        thresholds.push_back(1.0);
         Learner learner = trainStage();
+        if (resumed && fPosVec.size() > (size_t) i) {
+            // The checkpoint was taken in the middle of this stage.
+            learner.weakClassifiers = mkshd<classifiervec>(resumed->stage);
+            learner.weights = resumed->weights;
+            n = (int) resumed->stage.size();
+        } else {
+            fPosVec.push_back(fPosVec[i - 1]);
+            mDecVec.push_back(mDecVec[i - 1]);
+            thresholds.push_back(1.0);
+        }
+        resumed = nullptr;
         shdptr<classifiervec> classifiers = learner.train(n);
+        ValidationScores validation{fltvec(validationSamples->size(), 0), 0, 0};
         while (fPosVec[i] > fPos * fPosVec[i - 1]) {
             n++;
             classifiers = learner.train(n);
-            auto eval = evaluate(*classifiers, thresholds[i]);
+            scoreValidation(*classifiers, validation);
+            thresholds[i] = stageThreshold(validation, mDec * mDecVec[i - 1]);
+            auto eval = evaluate(validation, thresholds[i]);
             fPosVec[i] = eval.falsePositiveRate;
             mDecVec[i] = eval.detectionRate;
-
-            while (mDecVec[i] < mDec * mDecVec[i - 1]) {
-                const flt DECREMENT_AMT = 0.01;
-                thresholds[i] -= DECREMENT_AMT;
-
-                eval = evaluate(*classifiers, thresholds[i]);
-                fPosVec[i] = eval.falsePositiveRate;
-                mDecVec[i] = eval.detectionRate;
-            }
             std::cout << std::endl;
             printf("==== fPosVec[%d]: %f, thresholds[%d]: %f\n", i, fPosVec[i], i, thresholds[i]);
+            saveCheckpoint(cascade.size(), fPosVec, mDecVec, thresholds, &learner);
         }
 
         auto time_since_stage_start = std::chrono::duration_cast<std::chrono::seconds>(
@@ -87,69 +141,405 @@ AttentionalCascade::train(flt maxFalsePositive, flt minDetection, flt targetOver
         printf("CASCADE LAYER %d FINISHED [%lds] === fPos[%d]: %f, mDec[%d]: %f, thresholds[i]: %f | TARGET_DIFF = %f\n",
                i, time_since_stage_start, i, fPosVec[i], i, mDecVec[i], thresholds[i], fPosTar - fPosVec[i]);
 
+        calibrateRejection(*classifiers, thresholds[i]);
+        cascade.push_back(classifiers);
         if (fPosVec[i] > fPosTar) {
             reduceFalsePositives(*classifiers, thresholds[i]);
+            printf("Number of negative samples left: %zu\n", negColumns.size());
+            reduceValidation(*classifiers, thresholds[i]);
+            if (miner) mineNegatives(cascade, thresholds);
         }
-        printf("Number of negative samples left: %zu\n", negIntegrals.size());
+        if (!checkpointDir.empty()) {
+            char path[300];
+            snprintf(path, sizeof path, "%s/%zu.csv", checkpointDir.c_str(), cascade.size() - 1);
+            save_weak_classifiers(path, *classifiers);
 
-        cascade.push_back(classifiers);
+            vec<classifiervec> stages;
+            for (const auto &stage: cascade) {
+                stages.push_back(*stage);
+            }
+            // thresholds[0] belongs to no stage.
+            fltvec stageThresholds(thresholds.begin() + 1, thresholds.begin() + 1 + (long) cascade.size());
+            CascadeModel::save(checkpointDir + "/" + MODEL_FILE, stages, stageThresholds);
+        }
+        saveCheckpoint(cascade.size(), fPosVec, mDecVec, thresholds, nullptr);
     }
     return cascade;
 }
 
+#define CHECKPOINT_FILE "checkpoint.txt"
+#define CHECKPOINT_VERSION 4
+
+static void
+write_values(std::ostream &out, const char *name, const fltvec &values) {
+    out << name << " " << values.size() << "\n";
+    char buf[32];
+    for (flt v: values) {
+        snprintf(buf, sizeof buf, "%a", v);
+        out << buf << " ";
+    }
+    out << "\n";
+}
+
+static fltvec
+read_values(std::istream &in, const char *name) {
+    std::string key;
+    size_t count;
+    in >> key >> count;
+    if (key != name) throw std::runtime_error(std::string("Checkpoint is missing ") + name);
+    fltvec values(count);
+    for (auto &v: values) {
+        std::string token;
+        in >> token;
+        v = std::strtod(token.c_str(), nullptr);
+    }
+    return values;
+}
+
 void
-AttentionalCascade::reduceFalsePositives(const classifiervec &cascade, flt threshold) {
-    size_t n = negIntegrals.size();
-    for (int i = 0; i < n; ++i) {
-        auto img = negIntegrals[i];
-        auto h = Learner::strongClassifier(*img, cascade);
-        auto is_rejected = h.confidenceInterval < threshold;
-        if (is_rejected) continue;
-        if (h.label() == 0) {
-            negIntegrals.erase(negIntegrals.begin() + i);
-            i--;
-            n--;
+AttentionalCascade::useCheckpoints(const std::string &dir, uint32_t seed) {
+    checkpointDir = dir;
+    checkpointSeed = seed;
+}
+
+void
+AttentionalCascade::saveCheckpoint(size_t completed, const fltvec &falsePositives, const fltvec &detections,
+                                   const fltvec &thresholds, const Learner *learner) const {
+    if (checkpointDir.empty()) return;
+    std::string path = checkpointDir + "/" + CHECKPOINT_FILE;
+    {
+        std::ofstream out(path + ".tmp");
+        out << "checkpoint " << CHECKPOINT_VERSION << "\n";
+        out << "seed " << checkpointSeed << "\n";
+        out << "rng " << rng() << "\n";
+        out << "completed " << completed << "\n";
+        write_values(out, "false_positives", falsePositives);
+        write_values(out, "detections", detections);
+        write_values(out, "thresholds", thresholds);
+
+        out << "negatives " << negColumns.size() << "\n";
+        for (uint32_t c: negColumns) {
+            out << c << " ";
+        }
+        out << "\n";
+        out << "mined " << mined << "\n";
+        out << "samples " << (mined ? std::filesystem::path(samples->path).filename().string() : "-") << "\n";
+        out << "mining_cursor " << (miner ? miner->cursor : 0) << "\n";
+
+        // Hexadecimal floats, so the resumed stage continues from exactly the same thresholds and weights.
+        const classifiervec empty;
+        const classifiervec &stage = learner ? *learner->weakClassifiers : empty;
+        out << "stage " << stage.size() << "\n";
+        char buf[80];
+        for (const auto &c: stage) {
+            snprintf(buf, sizeof buf, "%a,%d,%a,", c.threshold, c.polarity, c.alpha);
+            out << buf << c.feat->csv() << "\n";
+        }
+        write_values(out, "weights", learner ? learner->weights : fltvec());
+        if (!out) throw std::runtime_error("Could not write checkpoint: " + path);
+    }
+    std::filesystem::rename(path + ".tmp", path);
+    // Training sets mined for earlier stages, and their responses, are no longer referred to.
+    if (mined && !learner) {
+        vec<std::filesystem::path> current = {samples->path};
+        if (responses) current.emplace_back(responses->path);
+        if (sorted) current.emplace_back(sorted->path);
+        if (bins) current.emplace_back(bins->path);
+        for (const auto &entry: std::filesystem::directory_iterator(checkpointDir)) {
+            std::string name = entry.path().filename().string();
+            bool derived = name.rfind("samples_", 0) == 0 || name.rfind("responses_", 0) == 0 ||
+                           name.rfind("sorted_", 0) == 0 || name.rfind("bins_", 0) == 0;
+            if (derived && std::find(current.begin(), current.end(), entry.path()) == current.end()) {
+                std::filesystem::remove(entry.path());
+            }
+        }
+    }
+}
+
+Checkpoint
+AttentionalCascade::loadCheckpoint(const std::string &dir) {
+    std::string path = dir + "/" + CHECKPOINT_FILE;
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Could not open checkpoint: " + path);
+
+    Checkpoint checkpoint;
+    std::string key;
+    int version;
+    in >> key >> version;
+    if (key != "checkpoint" || version != CHECKPOINT_VERSION) {
+        throw std::runtime_error("Not a checkpoint of this version: " + path);
+    }
+    in >> key >> checkpoint.seed;
+    in >> key;
+    std::getline(in >> std::ws, checkpoint.rngState);
+    in >> key >> checkpoint.completed;
+    checkpoint.falsePositives = read_values(in, "false_positives");
+    checkpoint.detections = read_values(in, "detections");
+    checkpoint.thresholds = read_values(in, "thresholds");
+
+    size_t count;
+    in >> key >> count;
+    checkpoint.negatives.resize(count);
+    for (auto &c: checkpoint.negatives) {
+        in >> c;
+    }
+    in >> key >> checkpoint.mined;
+    in >> key >> checkpoint.samples;
+    in >> key >> checkpoint.miningCursor;
+
+    in >> key >> count;
+    std::string line;
+    std::getline(in, line);
+    for (size_t k = 0; k < count; ++k) {
+        std::getline(in, line);
+        checkpoint.stage.push_back(load_weak_classifier(line));
+    }
+    checkpoint.weights = read_values(in, "weights");
+    if (!in) throw std::runtime_error("Checkpoint is truncated: " + path);
+    return checkpoint;
+}
+
+void
+AttentionalCascade::resumeFrom(const Checkpoint &checkpoint) {
+    // The negatives index the set the checkpoint was written with: the mined one if there is one, even when later
+    // stages found nothing to add to it. Check them against that set before anything is replaced.
+    shdptr<SampleStore> store = samples;
+    if (checkpoint.mined) {
+        store = SampleStore::open(checkpointDir + "/" + checkpoint.samples);
+        if (store->height() != samples->height() || store->width() != samples->width() ||
+            store->size() < posColumns.size()) {
+            throw std::runtime_error("Checkpoint does not match the training set");
+        }
+    }
+    for (uint32_t c: checkpoint.negatives) {
+        bool negative = checkpoint.mined ? c >= posColumns.size() : c < labels.size() && labels[c] == 0;
+        if (c >= store->size() || !negative) {
+            throw std::runtime_error("Checkpoint does not match the training set");
+        }
+    }
+
+    std::istringstream state(checkpoint.rngState);
+    state >> rng();
+    if (checkpoint.mined) {
+        useTrainingSet(store, posColumns.size());
+        mined = true;
+    }
+    if (miner) {
+        miner->cursor = checkpoint.miningCursor;
+    }
+    negColumns = checkpoint.negatives;
+    resumed = mkshd<Checkpoint>(checkpoint);
+}
+
+void
+AttentionalCascade::reduceFalsePositives(const classifiervec &stage, flt threshold) {
+    FeatureTable table = Learner::compile(stage, *samples);
+    size_t kept = 0;
+    for (uint32_t c: negColumns) {
+        if (Learner::strongClassifier(*samples, c, stage, table).confidenceInterval < threshold) continue;
+        negColumns[kept++] = c;
+    }
+    negColumns.resize(kept);
+}
+
+void
+AttentionalCascade::calibrateRejection(classifiervec &stage, flt threshold) const {
+    FeatureTable table = Learner::compile(stage, *validationSamples);
+    flt alpha_sum = 0;
+    for (const auto &c: stage) {
+        alpha_sum += c.alpha;
+    }
+
+    // Positives this stage accepts, with their sums before any classifier ran.
+    vec<size_t> accepted;
+    for (size_t i = 0; i < validationSamples->size(); ++i) {
+        if (validationLabels[i] != 1 || !validationPassed[i]) continue;
+        if (Learner::strongClassifier(*validationSamples, i, stage, table).confidenceInterval >= threshold) {
+            accepted.push_back(i);
+        }
+    }
+    fltvec sums(accepted.size(), 0);
+
+    const flt inf = std::numeric_limits<flt>::infinity();
+    for (size_t k = 0; k < stage.size(); ++k) {
+        flt trace = inf;
+        for (size_t j = 0; j < accepted.size(); ++j) {
+            sums[j] += stage[k].alpha * (flt) Learner::runWeakClassifier(*validationSamples, accepted[j], stage[k],
+                                                                        table, k);
+            trace = std::min(trace, sums[j]);
+        }
+        // Without positives to keep there is nothing to calibrate against.
+        stage[k].rejectThreshold = accepted.empty() ? -inf : trace;
+    }
+    if (!accepted.empty()) {
+        stage.back().rejectThreshold = std::min(stage.back().rejectThreshold, threshold * alpha_sum);
+    }
+}
+
+void
+AttentionalCascade::reduceValidation(const classifiervec &stage, flt threshold) {
+    FeatureTable table = Learner::compile(stage, *validationSamples);
+    for (size_t i = 0; i < validationSamples->size(); ++i) {
+        if (!validationPassed[i]) continue;
+        validationPassed[i] =
+                Learner::strongClassifier(*validationSamples, i, stage, table).confidenceInterval >= threshold;
+    }
+}
+
+void
+AttentionalCascade::mineNegatives(const vec<shdptr<classifiervec>> &cascade, const fltvec &thresholds) {
+    if (negColumns.size() >= negativeTarget) return;
+    if (miner->exhausted()) {
+        printf("Mining: every background image was scanned, training on %zu negatives\n", negColumns.size());
+        return;
+    }
+
+    vec<classifiervec> stages;
+    for (const auto &stage: cascade) {
+        stages.push_back(*stage);
+    }
+    // thresholds[0] belongs to no stage.
+    fltvec stageThresholds(thresholds.begin() + 1, thresholds.begin() + 1 + (long) cascade.size());
+
+    MiningReport report{};
+    auto found = miner->mine(stages, stageThresholds, negativeTarget - negColumns.size(), report);
+    printf("Mining: %zu negatives from %zu images in %.1fs, %zu false positives in %zu windows (yield %.4f%%, "
+           "%.0f windows/s)\n", report.kept, report.images, report.seconds, report.found, report.windows,
+           report.windows ? 100.0 * (double) report.found / (double) report.windows : 0.0,
+           report.seconds > 0 ? (double) report.windows / report.seconds : 0.0);
+    if (found.empty()) return;
+
+    // The new set is the positives, the negatives that are left and the mined ones, copied sample by sample so the
+    // old set is never loaded whole. A run with checkpoints keeps it next to them, as it cannot be sampled again.
+    vec<uint32_t> kept = posColumns;
+    kept.insert(kept.end(), negColumns.begin(), negColumns.end());
+    const int height = samples->height();
+    const int width = samples->width();
+    auto store = SampleStore::create(
+            checkpointDir.empty() ? CACHE_DIR : checkpointDir, sampleFormat, height, width, kept.size() + found.size(),
+            [&](size_t i, ImgFlt *values) {
+                if (i < kept.size()) {
+                    samples->read(kept[i], values);
+                    return;
+                }
+                const ImgType &im = *found[i - kept.size()];
+                for (int y = 0; y < height; ++y) {
+                    std::memcpy(values + (size_t) y * width, im.row(y), width * sizeof(ImgFlt));
+                }
+            });
+    found.clear();
+
+    // Without checkpoints nothing refers to an earlier mined set any more.
+    if (mined && checkpointDir.empty() && store->path != samples->path) {
+        std::filesystem::remove(samples->path);
+    }
+    useTrainingSet(store, posColumns.size());
+    mined = true;
+}
+
+void
+AttentionalCascade::useTrainingSet(shdptr<SampleStore> store, size_t positives) {
+    samples = std::move(store);
+    labels.assign(samples->size(), 0);
+    std::fill(labels.begin(), labels.begin() + (long) positives, 1);
+    posColumns.resize(positives);
+    std::iota(posColumns.begin(), posColumns.end(), 0);
+    negColumns.resize(samples->size() - positives);
+    std::iota(negColumns.begin(), negColumns.end(), (uint32_t) positives);
+    if (!responses) return;
+
+    // The matrices are keyed by the samples, so a new set needs new ones. Like the mined sets themselves they are kept
+    // beside the checkpoints, which drop those of earlier sets (see saveCheckpoint()); without checkpoints the ones of
+    // the mined set they replace are removed here. Those of the sampled set stay cached for the next run.
+    vec<std::string> replaced;
+    if (mined && checkpointDir.empty()) {
+        replaced.push_back(responses->path);
+        if (sorted) replaced.push_back(sorted->path);
+        if (bins) replaced.push_back(bins->path);
+    }
+    loadResponses(checkpointDir.empty() ? CACHE_DIR : checkpointDir);
+    for (const auto &path: replaced) {
+        if (path != responses->path && (!sorted || path != sorted->path) && (!bins || path != bins->path)) {
+            std::filesystem::remove(path);
         }
     }
 }
 
 Learner
 AttentionalCascade::trainStage() {
-    vec<shdptr<ImgType>> ims;
-    ims.reserve(posIntegrals.size() + negIntegrals.size());
-    ims.insert(ims.end(), posIntegrals.begin(), posIntegrals.end());
-    ims.insert(ims.end(), negIntegrals.begin(), negIntegrals.end());
+    vec<uint32_t> cols;
+    cols.reserve(posColumns.size() + negColumns.size());
+    cols.insert(cols.end(), posColumns.begin(), posColumns.end());
+    cols.insert(cols.end(), negColumns.begin(), negColumns.end());
 
     vec<int> lbls;
-    lbls.reserve(posIntegrals.size() + negIntegrals.size());
-    lbls.insert(lbls.end(), posIntegrals.size(), 1);
-    lbls.insert(lbls.end(), negIntegrals.size(), 0);
+    lbls.reserve(cols.size());
+    lbls.insert(lbls.end(), posColumns.size(), 1);
+    lbls.insert(lbls.end(), negColumns.size(), 0);
 
-    return {ims, lbls, features};
+    Learner learner(samples, cols, lbls, features);
+    learner.useWeightTrimming(trimFraction);
+    learner.useFeatureSampling(sampling);
+    if (responses) {
+        learner.useResponses(responses);
+        if (sorted) learner.useSortedIndex(sorted);
+        if (bins) learner.useBins(bins);
+    }
+    return learner;
 }
 
-Evaluation
-AttentionalCascade::evaluate(const classifiervec &weakClassifiers, flt threshold) {
-    size_t n = validationLabels.size();
-    int falsePositive = 0;
-    int truePositive = 0;
-    int truePositives = 0;
-
-    for (int i = 0; i < n; ++i) {
-        auto img = validationIntegrals[i];
-        auto label = validationLabels[i];
-        auto h = Learner::strongClassifier(*img, weakClassifiers);
-        auto is_rejected = h.confidenceInterval < threshold;
-        if (is_rejected) continue;
+void
+AttentionalCascade::scoreValidation(const classifiervec &weakClassifiers, ValidationScores &scores) const {
+    classifiervec added(weakClassifiers.begin() + (long) scores.classifiers, weakClassifiers.end());
+    FeatureTable table = Learner::compile(added, *validationSamples);
+    for (size_t k = 0; k < added.size(); ++k) {
+        const auto &c = added[k];
+        for (size_t i = 0; i < validationSamples->size(); ++i) {
+            if (!validationPassed[i]) continue;
+            scores.scores[i] += c.alpha * (flt) Learner::runWeakClassifier(*validationSamples, i, c, table, k);
+        }
+        scores.alphaSum += c.alpha;
+    }
+    scores.classifiers = weakClassifiers.size();
+}
 
-        auto lbl = h.label();
-        if (lbl == 1 && label == 1) { truePositive++; }
-        if (lbl == 1 && label == 0) { falsePositive++; }
+Evaluation
+AttentionalCascade::evaluate(const ValidationScores &scores, flt threshold) const {
+    size_t falsePositive = 0;
+    size_t truePositive = 0;
+    size_t positives = 0;
 
-        if (label == 1) { truePositives++; }
+    for (size_t i = 0; i < validationLabels.size(); ++i) {
+        bool accepted = validationPassed[i] && scores.scores[i] / scores.alphaSum >= threshold;
+        if (validationLabels[i] == 1) {
+            positives++;
+            if (accepted) truePositive++;
+        } else if (accepted) {
+            falsePositive++;
+        }
     }
+    size_t negatives = validationLabels.size() - positives;
     Evaluation eval{};
-    eval.falsePositiveRate = falsePositive / (flt) (n);
-    eval.detectionRate = truePositive / (flt) (truePositives);
+    eval.falsePositiveRate = negatives ? falsePositive / (flt) negatives : 0;
+    eval.detectionRate = positives ? truePositive / (flt) positives : 1;
     return eval;
 }
+
+flt
+AttentionalCascade::stageThreshold(const ValidationScores &scores, flt minDetection) const {
+    fltvec positives;   // confidence of the positives earlier stages let through
+    size_t total = 0;
+    for (size_t i = 0; i < validationLabels.size(); ++i) {
+        if (validationLabels[i] != 1) continue;
+        total++;
+        if (validationPassed[i]) positives.push_back(scores.scores[i] / scores.alphaSum);
+    }
+    if (positives.empty()) return 1.0;
+
+    // Accepting the `needed` best scoring positives reaches minDetection over all of them; the threshold is the lowest
+    // of those. If earlier stages already lost too many, accept every positive that is left.
+    auto needed = (size_t) std::ceil(minDetection * (flt) total - 1e-9);
+    needed = std::clamp<size_t>(needed, 1, positives.size());
+    std::nth_element(positives.begin(), positives.begin() + (long) (needed - 1), positives.end(), std::greater<>());
+    return positives[needed - 1];
+}
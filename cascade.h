@@ -5,38 +5,179 @@
 #include "feature.h"
 #include "utils.h"
 #include "learner.h"
+#include "mining.h"
+#include "sample_store.h"
 
 typedef struct {
     flt falsePositiveRate;
     flt detectionRate;
 } Evaluation;
 
+/**
+ * @brief Strong classifier score of every validation sample for the first `classifiers` weak classifiers of a stage,
+ * so adding a weak classifier only evaluates that one.
+ */
+typedef struct {
+    fltvec scores;
+    flt alphaSum;
+    size_t classifiers;
+} ValidationScores;
+
+/**
+ * @brief Everything AttentionalCascade::train needs to continue a run: the RNG that sampled the data, the rates and
+ * thresholds of every stage so far, the negatives left, and the weak classifiers and sample weights of the stage in
+ * progress. Stages before `completed` are read back from their CSV files. Once negatives were mined the training set
+ * can no longer be sampled from the seed, so it is the sample store `samples` in the checkpoint directory.
+ */
+typedef struct {
+    uint32_t seed;
+    std::string rngState;
+    size_t completed;
+    fltvec falsePositives;      // F of every stage, [0] = 1
+    fltvec detections;          // D of every stage, [0] = 1
+    fltvec thresholds;
+    vec<uint32_t> negatives;    // negColumns
+    bool mined;                 // negatives were replaced by mining, see AttentionalCascade::useNegativeMining
+    std::string samples;        // file name of the training set if mined
+    size_t miningCursor;
+    classifiervec stage;
+    fltvec weights;
+} Checkpoint;
+
 class AttentionalCascade {
 private:
-    vec<shdptr<ImgType>> integrals;
-    vec<int> labels;
+    shdptr<SampleStore> samples;        // normalized integrals of the training set
+    vec<int> labels;                    // of every sample in `samples`
     shdptr<vec<shdptr<Feature>>> features;
+    SampleFormat sampleFormat;
 
-    vec<shdptr<ImgType>> validationIntegrals;
+    shdptr<SampleStore> validationSamples;
     vec<int> validationLabels;
+    vec<bool> validationPassed;         // accepted by every completed stage
+
+    vec<uint32_t> posColumns;           // the positive set always stay the same (only contains faces)
+    vec<uint32_t> negColumns;           // the negative set gets reduced on each iteration (only contains non-faces)
+    size_t negativeTarget;              // size of the initial negative set, refilled to by mining
+    shdptr<NegativeMiner> miner;
+    bool mined = false;                 // `samples` holds mined negatives instead of the sampled ones
+
+    shdptr<ResponseMatrix> responses;   // responses of every feature on `samples`, if precomputed
+    shdptr<SortedIndex> sorted;         // order of `responses` for SearchSorted
+    shdptr<ResponseBins> bins;          // quantized `responses` for SearchBinned
+    ResponseFormat responseFormat = ResponseFloat32;
+    ThresholdSearch responseSearch = SearchExact;
+    uint32_t responseBins = 256;
+    flt trimFraction = 1.0;             // see Learner::useWeightTrimming
+    SamplingOptions sampling{SampleAll, 1.0, 0, 2, 32, false};
 
-    vec<shdptr<ImgType>> posIntegrals;  // the positive set always stay the same (only contains faces)
-    vec<shdptr<ImgType>> negIntegrals;  // the negative set gets reduced on each iteration (only contains non-faces)
+    std::string checkpointDir;          // empty: no checkpoints
+    uint32_t checkpointSeed = 0;
+    shdptr<Checkpoint> resumed;
 
-    Evaluation evaluate(const classifiervec &weakClassifiers, flt threshold);
+    void saveCheckpoint(size_t completed, const fltvec &falsePositives, const fltvec &detections,
+                        const fltvec &thresholds, const Learner *learner) const;
+
+    /**
+     * @brief Add the weak classifiers not yet in `scores` to the scores of the validation samples.
+     */
+    void scoreValidation(const classifiervec &weakClassifiers, ValidationScores &scores) const;
+
+    /**
+     * @brief Rates of the cascade when the stage accepts a validation sample whose score is at least
+     * `threshold` * alphaSum. Samples earlier stages rejected count as rejected.
+     */
+    Evaluation evaluate(const ValidationScores &scores, flt threshold) const;
+
+    /**
+     * @brief Highest threshold at which the cascade still accepts `minDetection` of the validation positives.
+     */
+    flt stageThreshold(const ValidationScores &scores, flt minDetection) const;
 
     Learner trainStage();
 
-    void reduceFalsePositives(const classifiervec &cascade, flt threshold);
+    /**
+     * @brief Set the rejectThreshold of every classifier of `stage` to the lowest partial sum, up to that classifier,
+     * of the validation positives the cascade accepts with `threshold` for this stage. The last one is at most
+     * `threshold` times the alpha sum, so rejecting below the trace keeps every such positive and decides the stage.
+     */
+    void calibrateRejection(classifiervec &stage, flt threshold) const;
+
+    /**
+     * @brief Drop the negatives `stage` rejects, keeping the order of the others.
+     */
+    void reduceFalsePositives(const classifiervec &stage, flt threshold);
+
+    /**
+     * @brief Mark the validation samples `stage` rejects, so later stages are rated on what the cascade lets through.
+     */
+    void reduceValidation(const classifiervec &stage, flt threshold);
+
+    /**
+     * @brief Refill the negatives to negativeTarget with false positives of `cascade` mined from the backgrounds.
+     */
+    void mineNegatives(const vec<shdptr<classifiervec>> &cascade, const fltvec &thresholds);
+
+    /**
+     * @brief Train on `store`, which holds `positives` faces followed by negatives, and rebuild the response matrices
+     * over it.
+     */
+    void useTrainingSet(shdptr<SampleStore> store, size_t positives);
+
+    /**
+     * @brief Load (or build) the response matrix of `samples` and its index for responseSearch in `dir`.
+     */
+    void loadResponses(const std::string &dir);
 public:
-    AttentionalCascade(vec<ImgType> ims,
+    /**
+     * @param format How the training and validation integrals are stored, see SampleStore. They are written to
+     * CACHE_DIR; `ims` and `validation` are released as they are stored.
+     */
+    AttentionalCascade(images ims,
                        vec<int> lbls,
                        const Features &feats,
-                       Stats stats,
-                       Samples validation);
+                       Samples validation,
+                       SampleFormat format = SampleFloat64);
 
     ~AttentionalCascade() = default;
 
+    /**
+     * @brief Load (or build and cache in CACHE_DIR) the response matrix of all features on the training set. Every
+     * stage then reads its samples' columns from it. SearchSorted also loads (or builds) the sorted index of the matrix,
+     * SearchBinned the matrix quantized to `numBins` bins per feature.
+     */
+    void precomputeResponses(ResponseFormat format, ThresholdSearch search = SearchExact, uint32_t numBins = 256);
+
+    /**
+     * @brief Train every stage with Learner::useWeightTrimming(fraction).
+     */
+    void useWeightTrimming(flt fraction) { trimFraction = fraction; }
+
+    /**
+     * @brief Train every stage with Learner::useFeatureSampling(options).
+     */
+    void useFeatureSampling(const SamplingOptions &options) { sampling = options; }
+
+    /**
+     * @brief After every stage, refill the negatives it removed with windows of full `backgrounds` images that the
+     * cascade so far still accepts. Without it the negative set only shrinks.
+     */
+    void useNegativeMining(const paths &backgrounds, const MiningOptions &options);
+
+    /**
+     * @brief Write `<stage>.csv` and the model of the stages so far (MODEL_FILE, see CascadeModel) into `dir` as each
+     * stage completes, and a checkpoint after every boosting round.
+     * @param seed Seed the data was sampled with (see seed_rng), stored so a resumed run can sample the same data.
+     */
+    void useCheckpoints(const std::string &dir, uint32_t seed);
+
+    static Checkpoint loadCheckpoint(const std::string &dir);
+
+    /**
+     * @brief Continue from `checkpoint` in the next train() call. The cascade must be built from the same data, i.e.
+     * with the RNG seeded with `checkpoint.seed`, and set up with useCheckpoints and useNegativeMining first.
+     */
+    void resumeFrom(const Checkpoint &checkpoint);
+
     vec<shdptr<classifiervec>> train(flt maxFalsePositive, flt minDetection, flt targetOverallFalsePositive);
 
 };
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
+#include <new>
 #include <vector>
 
 #define FEATURE_SIZE 24
@@ -8,9 +10,12 @@
 #define IM_HEIGHT 288
 #define FP_FACES_DIR "../dataset/faces/"
 #define FP_BGS_DIR "../dataset/backgrounds/"
+#define CACHE_DIR "../cache/"
 #define FACES_CROP_TOP 50
 #define STATUS_EVERY 10000
 #define SCALE_FACTOR 1.25
+#define IMG_ALIGNMENT 64
+#define SAMPLE_MIN_STD (1.0 / 255.0)   // Runtime floor of 1 on the deviation of raw windows, on samples in [0, 1]
 
 typedef unsigned char uchar;
 
@@ -75,7 +75,7 @@ Feature::csv() const {
 }
 
 ImgFlt
-Feature::diff(const ImgType &img) const {
+Feature::diff(ImgViewType img) const {
     ImgFlt result = 0;
     auto [n, pts] = this->points();
     for (int i = 0; i < n; ++i) {
@@ -84,7 +84,18 @@ Feature::diff(const ImgType &img) const {
             std::cout << "ERR[OUT_OF_BOUNDS] diff: %s" << str() << std::endl;
             continue;
         }
-        result += (ImgFlt) pt.coef * img.arr[pt.y][pt.x];
+        result += (ImgFlt) pt.coef * img[(int) pt.y][pt.x];
+    }
+    return result;
+}
+
+ImgFlt
+Feature::flatResponse() const {
+    // The integral of a constant image of ones is x * y.
+    ImgFlt result = 0;
+    auto [n, pts] = this->points();
+    for (int i = 0; i < n; ++i) {
+        result += (ImgFlt) pts[i].coef * (ImgFlt) (pts[i].x * pts[i].y);
     }
     return result;
 }
@@ -104,6 +115,11 @@ Feature2h::name() const {
     return "2h";
 }
 
+FeatureType
+Feature2h::type() const {
+    return FeatType2h;
+}
+
 Feature2h::Feature2h(size_t x, size_t y, size_t width, size_t height) : Feature(x, y, width, height) {
     auto hw = width / 2;
     this->pts[0] = {x, y, 1};
@@ -132,6 +148,11 @@ Feature2v::name() const {
     return "2v";
 }
 
+FeatureType
+Feature2v::type() const {
+    return FeatType2v;
+}
+
 Feature2v::Feature2v(size_t x, size_t y, size_t width, size_t height) : Feature(x, y, width, height) {
     auto hh = height / 2;
     this->pts[0] = {x, y, -1};
@@ -160,6 +181,11 @@ Feature3h::name() const {
     return "3h";
 }
 
+FeatureType
+Feature3h::type() const {
+    return FeatType3h;
+}
+
 Feature3h::Feature3h(size_t x, size_t y, size_t width, size_t height) : Feature(x, y, width, height) {
     auto tw = width / 3;
     this->pts[0] = {x, y, -1};
@@ -193,6 +219,11 @@ Feature3v::name() const {
     return "3v";
 }
 
+FeatureType
+Feature3v::type() const {
+    return FeatType3v;
+}
+
 Feature3v::Feature3v(size_t x, size_t y, size_t width, size_t height) : Feature(x, y, width, height) {
     auto th = height / 3;
     this->pts[0] = {x, y, -1};
@@ -226,6 +257,11 @@ Feature4::name() const {
     return "4r";
 }
 
+FeatureType
+Feature4::type() const {
+    return FeatType4;
+}
+
 Feature4::Feature4(size_t x, size_t y, size_t width, size_t height) : Feature(x, y, width, height) {
     auto hw = width / 2;
     auto hh = height / 2;
@@ -320,4 +356,21 @@ feature_vec(const Features &features) {
     for (auto &f: features.f3v) feats.push_back(mkshd<Feature3v>(f));
     for (auto &f: features.f4) feats.push_back(mkshd<Feature4>(f));
     return feats;
-}
\ No newline at end of file
+}
+
+shdptr<Feature>
+make_feature(FeatureType type, size_t x, size_t y, size_t width, size_t height) {
+    switch (type) {
+        case FeatType2h:
+            return std::make_shared<Feature2h>(x, y, width, height);
+        case FeatType2v:
+            return std::make_shared<Feature2v>(x, y, width, height);
+        case FeatType3h:
+            return std::make_shared<Feature3h>(x, y, width, height);
+        case FeatType3v:
+            return std::make_shared<Feature3v>(x, y, width, height);
+        case FeatType4:
+            return std::make_shared<Feature4>(x, y, width, height);
+    }
+    throw std::runtime_error("Unknown feature type: " + std::to_string((int) type));
+}
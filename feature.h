@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include "image.h"
 
 typedef struct {
@@ -14,6 +15,14 @@ typedef struct {
     int y;
 } XY;
 
+enum FeatureType : uint8_t {
+    FeatType2h,
+    FeatType2v,
+    FeatType3h,
+    FeatType3v,
+    FeatType4
+};
+
 std::vector<int>
 possible_positions(int size, int window);
 
@@ -45,7 +54,14 @@ public:
 
     [[nodiscard]] virtual const char *name() const = 0;
 
-    [[nodiscard]] ImgFlt diff(const ImgType &img) const;
+    [[nodiscard]] virtual FeatureType type() const = 0;
+
+    [[nodiscard]] ImgFlt diff(ImgViewType img) const;
+
+    /**
+     * @brief Response on an image where every pixel is 1, i.e. the signed area covered by the feature.
+     */
+    [[nodiscard]] ImgFlt flatResponse() const;
 };
 
 class Feature2h : public Feature {
@@ -60,6 +76,8 @@ public:
     [[nodiscard]] static XY baseSize();
 
     [[nodiscard]] const char *name() const override;
+
+    [[nodiscard]] FeatureType type() const override;
 };
 
 class Feature2v : public Feature {
@@ -74,6 +92,8 @@ public:
     [[nodiscard]] static XY baseSize();
 
     [[nodiscard]] const char *name() const override;
+
+    [[nodiscard]] FeatureType type() const override;
 };
 
 class Feature3h : public Feature {
@@ -89,6 +109,8 @@ public:
 
     [[nodiscard]] const char *name() const override;
 
+    [[nodiscard]] FeatureType type() const override;
+
 };
 
 class Feature3v : public Feature {
@@ -103,6 +125,8 @@ public:
     [[nodiscard]] static XY baseSize();
 
     [[nodiscard]] const char *name() const override;
+
+    [[nodiscard]] FeatureType type() const override;
 };
 
 class Feature4 : public Feature {
@@ -117,6 +141,8 @@ public:
     [[nodiscard]] static XY baseSize();
 
     [[nodiscard]] const char *name() const override;
+
+    [[nodiscard]] FeatureType type() const override;
 };
 
 typedef struct {
@@ -131,4 +157,9 @@ Features generate_features();
 
 void print_features(const Features &features);
 
-std::vector<shdptr<Feature>> feature_vec(const Features &features);
\ No newline at end of file
+std::vector<shdptr<Feature>> feature_vec(const Features &features);
+
+/**
+ * @brief A feature of the given type and geometry.
+ */
+shdptr<Feature> make_feature(FeatureType type, size_t x, size_t y, size_t width, size_t height);
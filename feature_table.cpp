@@ -0,0 +1,41 @@
+#include "feature_table.h"
+
+template<FeatureType Type>
+static void
+append_offsets(const Feature &feat, size_t stride, vec<int32_t> &offsets) {
+    size_t at = offsets.size();
+    offsets.resize(at + HaarKernel<Type>::N);
+    HaarKernel<Type>::offsets(feat.x, feat.y, feat.width, feat.height, stride, offsets.data() + at);
+}
+
+FeatureTable::FeatureTable(const vec<shdptr<Feature>> &features, int height, int width, size_t stride) {
+    this->stride = stride;
+    types.reserve(features.size());
+    begins.reserve(features.size());
+
+    for (const auto &feat: features) {
+        if (feat->x + feat->width >= (size_t) width || feat->y + feat->height >= (size_t) height) {
+            throw std::runtime_error("Feature out of bounds of the integral window: " + feat->str());
+        }
+
+        begins.push_back((uint32_t) offsets.size());
+        types.push_back(feat->type());
+        switch (feat->type()) {
+            case FeatType2h:
+                append_offsets<FeatType2h>(*feat, stride, offsets);
+                break;
+            case FeatType2v:
+                append_offsets<FeatType2v>(*feat, stride, offsets);
+                break;
+            case FeatType3h:
+                append_offsets<FeatType3h>(*feat, stride, offsets);
+                break;
+            case FeatType3v:
+                append_offsets<FeatType3v>(*feat, stride, offsets);
+                break;
+            case FeatType4:
+                append_offsets<FeatType4>(*feat, stride, offsets);
+                break;
+        }
+    }
+}
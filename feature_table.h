@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <utility>
+#include "feature.h"
+
+/**
+ * @brief A rectangle of a Haar feature on its corner grid, added with `sign`. Corners get +sign top left and bottom
+ * right, -sign top right and bottom left, as in the Feature constructors.
+ */
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    int sign;
+} GridRect;
+
+/**
+ * @brief Grid layout of each feature type: the feature is split into NX x NY cells, giving (NX + 1) x (NY + 1) corners.
+ */
+template<FeatureType Type>
+struct HaarPattern;
+
+template<>
+struct HaarPattern<FeatType2h> {
+    static constexpr int NX = 2, NY = 1;
+    static constexpr std::array<GridRect, 2> RECTS = {{{0, 0, 1, 1, 1}, {1, 0, 2, 1, -1}}};
+};
+
+template<>
+struct HaarPattern<FeatType2v> {
+    static constexpr int NX = 1, NY = 2;
+    static constexpr std::array<GridRect, 2> RECTS = {{{0, 0, 1, 1, -1}, {0, 1, 1, 2, 1}}};
+};
+
+template<>
+struct HaarPattern<FeatType3h> {
+    static constexpr int NX = 3, NY = 1;
+    static constexpr std::array<GridRect, 3> RECTS = {{{0, 0, 1, 1, -1}, {1, 0, 2, 1, 1}, {2, 0, 3, 1, -1}}};
+};
+
+template<>
+struct HaarPattern<FeatType3v> {
+    static constexpr int NX = 1, NY = 3;
+    static constexpr std::array<GridRect, 3> RECTS = {{{0, 0, 1, 1, -1}, {0, 1, 1, 2, 1}, {0, 2, 1, 3, -1}}};
+};
+
+template<>
+struct HaarPattern<FeatType4> {
+    static constexpr int NX = 2, NY = 2;
+    static constexpr std::array<GridRect, 4> RECTS = {{{0, 0, 1, 1, 1}, {1, 0, 2, 1, -1},
+                                                       {0, 1, 1, 2, -1}, {1, 1, 2, 2, 1}}};
+};
+
+/**
+ * @brief Coefficient of every grid corner, row major, with shared corners of neighbouring rectangles summed.
+ */
+template<int NX, int NY, size_t R>
+constexpr std::array<int8_t, (NX + 1) * (NY + 1)>
+merge_corners(const std::array<GridRect, R> &rects) {
+    std::array<int8_t, (NX + 1) * (NY + 1)> coefs{};
+    for (const auto &r: rects) {
+        coefs[r.y0 * (NX + 1) + r.x0] += r.sign;
+        coefs[r.y0 * (NX + 1) + r.x1] -= r.sign;
+        coefs[r.y1 * (NX + 1) + r.x0] -= r.sign;
+        coefs[r.y1 * (NX + 1) + r.x1] += r.sign;
+    }
+    return coefs;
+}
+
+template<size_t N>
+constexpr bool
+all_nonzero(const std::array<int8_t, N> &coefs) {
+    for (auto c: coefs) {
+        if (c == 0) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Evaluator for one feature type. The merged coefficients are compile time constants and the corner loop is
+ * unrolled, so a feature costs N loads from the integral and no coefficient loads.
+ */
+template<FeatureType Type>
+struct HaarKernel {
+    typedef HaarPattern<Type> Pattern;
+    static constexpr int NX = Pattern::NX;
+    static constexpr int NY = Pattern::NY;
+    static constexpr int N = (NX + 1) * (NY + 1);
+    static constexpr std::array<int8_t, N> COEFS = merge_corners<NX, NY>(Pattern::RECTS);
+    static_assert(all_nonzero(COEFS), "every corner of the grid must be read");
+
+    template<typename T, size_t... K>
+    static ImgFlt sum(const T *origin, const int32_t *offsets, std::index_sequence<K...>) {
+        return (... + ((ImgFlt) COEFS[K] * (ImgFlt) origin[offsets[K]]));
+    }
+
+    template<typename T>
+    static ImgFlt evaluate(const T *origin, const int32_t *offsets) {
+        return sum(origin, offsets, std::make_index_sequence<N>());
+    }
+
+    /**
+     * @brief Corner offsets, row major, of a feature at (x, y) of size w x h. Inner grid lines are at multiples of
+     * w / NX and h / NY, the outer ones at x + w and y + h, matching the Feature constructors.
+     */
+    static void offsets(size_t x, size_t y, size_t w, size_t h, size_t stride, int32_t *out) {
+        for (int j = 0; j <= NY; ++j) {
+            size_t cy = j == NY ? y + h : y + j * (h / NY);
+            for (int i = 0; i <= NX; ++i) {
+                size_t cx = i == NX ? x + w : x + i * (w / NX);
+                out[j * (NX + 1) + i] = (int32_t) (cy * stride + cx);
+            }
+        }
+    }
+};
+
+/**
+ * @brief Haar features compiled to flat arrays for one integral image layout.
+ *
+ * Every feature stores the HaarKernel<type>::N corners of its grid as offsets `y * stride + x` from the window origin;
+ * the coefficients are implied by the type. All corners are checked against the window size once, in the constructor,
+ * so evaluate() does no bounds checks. Index i corresponds to the i'th feature the table was built from.
+ */
+class FeatureTable {
+private:
+public:
+    size_t stride{};
+    vec<FeatureType> types;
+    vec<uint32_t> begins;   // corners of feature i start at offsets[begins[i]]
+    vec<int32_t> offsets;
+
+    FeatureTable() = default;
+
+    /**
+     * @param height Height of the integral window the features are evaluated on (i.e. image height + 1).
+     * @param width Width of the integral window.
+     * @param stride Row stride of the integral images.
+     */
+    FeatureTable(const vec<shdptr<Feature>> &features, int height, int width, size_t stride);
+
+    [[nodiscard]] size_t size() const { return types.size(); }
+
+    template<typename T>
+    [[nodiscard]] ImgFlt evaluate(size_t i, const T *origin) const {
+        const int32_t *offs = offsets.data() + begins[i];
+        switch (types[i]) {
+            case FeatType2h:
+                return HaarKernel<FeatType2h>::evaluate(origin, offs);
+            case FeatType2v:
+                return HaarKernel<FeatType2v>::evaluate(origin, offs);
+            case FeatType3h:
+                return HaarKernel<FeatType3h>::evaluate(origin, offs);
+            case FeatType3v:
+                return HaarKernel<FeatType3v>::evaluate(origin, offs);
+            case FeatType4:
+                return HaarKernel<FeatType4>::evaluate(origin, offs);
+        }
+        return 0;
+    }
+};
@@ -1,44 +1,75 @@
+#include <array>
+
 #include "image.h"
+#include "integral.h"
+
+#define GLEAM_GAMMA 2.2
+
+/**
+ * @brief Per channel share of gleam: the gamma corrected value divided by 3, rounded the same two times as applying
+ * gamma() and then averaging the channels.
+ */
+static std::array<uchar, 256>
+gleam_table(double gleam) {
+    std::array<uchar, 256> table{};
+    for (int v = 0; v < 256; ++v) {
+        auto corrected = cv::saturate_cast<uchar>(std::pow(v / 255.0, 1.0 / gleam) * 255.0);
+        table[v] = cv::saturate_cast<uchar>(corrected / 3.0);
+    }
+    return table;
+}
+
+static const std::array<uchar, 256> GLEAM_LUT = gleam_table(GLEAM_GAMMA);
 
 void
 gamma(cv::Mat &img, double gleam) {
-    gleam = 1.0 / gleam;
+    std::array<uchar, 256> table{};
+    for (int v = 0; v < 256; ++v) {
+        table[v] = cv::saturate_cast<uchar>(std::pow(v / 255.0, 1.0 / gleam) * 255.0);
+    }
     for (int y = 0; y < img.rows; ++y) {
-        for (int x = 0; x < img.cols; ++x) {
-            auto pix = img.at<cv::Vec3b>(y, x);
-            for (int c = 0; c < 3; ++c) {
-                img.at<cv::Vec3b>(y, x)[c] = cv::saturate_cast<uchar>(
-                        std::pow(pix[c] / 255.0, gleam) * 255.0);
-            }
+        uchar *px = img.ptr<uchar>(y);
+        for (int x = 0; x < img.cols * 3; ++x) {
+            px[x] = table[px[x]];
         }
     }
 }
 
-cv::Mat
-gleam(cv::Mat &img) {
-    gamma(img, 2.2);
-    cv::Mat gleamed(img.size(), CV_8UC1);
+template<typename T>
+void
+gleam(const cv::Mat &img, ImgView<T> dst) {
     for (int y = 0; y < img.rows; ++y) {
+        const uchar *src = img.ptr<uchar>(y);
+        T *out = dst[y];
         for (int x = 0; x < img.cols; ++x) {
-            gleamed.at<uchar>(y, x) = 0;
-            auto pix = img.at<cv::Vec3b>(y, x);
-            for (int c = 0; c < 3; ++c) {
-                gleamed.at<uchar>(y, x) += cv::saturate_cast<uchar>(pix[c] / 3.0);
-            }
+            // Each share is at most 85, so the sum cannot overflow.
+            out[x] = static_cast<T>((uchar) (GLEAM_LUT[src[3 * x]] + GLEAM_LUT[src[3 * x + 1]] +
+                                             GLEAM_LUT[src[3 * x + 2]]));
         }
     }
+}
+
+template void gleam<uchar>(const cv::Mat &img, ImgView<uchar> dst);
+
+template void gleam<float>(const cv::Mat &img, ImgView<float> dst);
+
+template void gleam<double>(const cv::Mat &img, ImgView<double> dst);
+
+cv::Mat
+gleam(const cv::Mat &img) {
+    cv::Mat gleamed(img.size(), CV_8UC1);
+    gleam(img, ImgView<uchar>(gleamed.ptr<uchar>(0), gleamed.rows, gleamed.cols, gleamed.step));
     return gleamed;
 }
 
 template<typename T>
 Img<T>::Img(int height, int width) {
+    const size_t per_line = std::max<size_t>(1, IMG_ALIGNMENT / sizeof(T));
     this->height = height;
     this->width = width;
-    this->arr.reserve(height);
-    for (size_t i = 0; i < height; ++i) {
-        std::vector<T> row(width);
-        this->arr.push_back(row);
-    }
+    // Pad rows so that every row starts on an aligned boundary.
+    this->stride = ((size_t) width + per_line - 1) / per_line * per_line;
+    this->data.resize(this->stride * height);
 }
 
 template<typename T>
@@ -46,33 +77,55 @@ void
 Img<T>::swap(Img<T> &other) {
     std::swap(height, other.height);
     std::swap(width, other.width);
-    std::swap(arr, other.arr);
+    std::swap(stride, other.stride);
+    std::swap(data, other.data);
 }
 
 template<typename T>
-Img<T>::~Img() {
-//    for (auto &row: this->arr) {
-//        row.clear();
-//    }
-//    this->arr.clear();
-}
+Img<T>::~Img() = default;
 
 template<typename T>
 Img<T> Img<T>::toIntegral() const {
     Img<T> integral(this->height + 1, this->width + 1);
-    for (size_t x = 0; x < integral.height; ++x) {
-        integral.arr[0][x] = 0;
-    }
-    for (size_t y = 0; y < integral.height; ++y) {
-        integral.arr[y][0] = 0;
-    }
-    for (size_t y = 0; y < this->height; ++y) {
-        for (size_t x = 0; x < this->width; ++x) {
-            integral.arr[y + 1][x + 1] =
-                    this->arr[y][x]
-                    + integral.arr[y][x + 1]
-                    + integral.arr[y + 1][x]
-                    - integral.arr[y][x];
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        ::integral(this->data.data(), this->stride, this->height, this->width, integral.data.data(), integral.stride);
+    } else {
+        for (size_t y = 0; y < this->height; ++y) {
+            const T *src = this->row(y);
+            const T *prev = integral.row(y);
+            T *dst = integral.row(y + 1);
+            T row_sum = 0;
+            for (size_t x = 0; x < this->width; ++x) {
+                row_sum += src[x];
+                dst[x + 1] = prev[x + 1] + row_sum;
+            }
+        }
+    }
+    return integral;
+}
+
+template<typename T>
+Img<T> Img<T>::toIntegral(Img<T> &squared) const {
+    Img<T> integral(this->height + 1, this->width + 1);
+    squared = Img<T>(this->height + 1, this->width + 1);
+    if constexpr (std::is_same_v<T, double> || std::is_same_v<T, float>) {
+        ::integral(this->data.data(), this->stride, this->height, this->width, integral.data.data(), integral.stride,
+                   squared.data.data(), squared.stride);
+    } else {
+        for (size_t y = 0; y < this->height; ++y) {
+            const T *src = this->row(y);
+            const T *prev = integral.row(y);
+            const T *prev_sq = squared.row(y);
+            T *dst = integral.row(y + 1);
+            T *dst_sq = squared.row(y + 1);
+            T row_sum = 0;
+            T row_sum_sq = 0;
+            for (size_t x = 0; x < this->width; ++x) {
+                row_sum += src[x];
+                row_sum_sq += src[x] * src[x];
+                dst[x + 1] = prev[x + 1] + row_sum;
+                dst_sq[x + 1] = prev_sq[x + 1] + row_sum_sq;
+            }
         }
     }
     return integral;
@@ -81,14 +134,24 @@ Img<T> Img<T>::toIntegral() const {
 template<typename T>
 void
 Img<T>::loadGrayScale(cv::Mat image) {
+    if constexpr (std::is_same_v<T, uchar> || std::is_same_v<T, float> || std::is_same_v<T, double>) {
+        if (image.rows == this->height && image.cols == this->width) {
+            // Already the right size, gleam straight into the pixel buffer.
+            gleam(image, this->view());
+            return;
+        }
+    }
+
     cv::Mat gleamed = gleam(image);
 
     cv::Mat resized;
     cv::resize(gleamed, resized, cv::Size(this->width, this->height));
 
     for (size_t y = 0; y < this->height; y++) {
+        const uchar *src = resized.ptr<uchar>((int) y);
+        T *dst = this->row(y);
         for (size_t x = 0; x < this->width; x++) {
-            this->arr[y][x] = static_cast<T>(resized.at<uchar>((int) y, (int) x));
+            dst[x] = static_cast<T>(src[x]);
         }
     }
 }
@@ -98,8 +161,9 @@ cv::Mat
 Img<T>::toMat() {
     cv::Mat mat(this->height, this->width, CV_8UC1);
     for (int y = 0; y < this->height; y++) {
+        const T *src = this->row(y);
         for (int x = 0; x < this->width; x++) {
-            mat.at<uchar>(y, x) = this->arr[y][x];
+            mat.at<uchar>(y, x) = src[x];
         }
     }
     return mat;
@@ -107,13 +171,13 @@ Img<T>::toMat() {
 
 template<typename T>
 void
-Img<T>::normalize() {
+Img<T>::normalize(T minStd) {
     double mean = 0;
     double std = 0;
     size_t total = 0;
     for (int y = 0; y < this->height; ++y) {
         for (int x = 0; x < this->width; ++x) {
-            mean += this->arr[y][x];
+            mean += this->row(y)[x];
             total++;
         }
     }
@@ -121,21 +185,22 @@ Img<T>::normalize() {
 
     for (int y = 0; y < this->height; ++y) {
         for (int x = 0; x < this->width; ++x) {
-            std += std::pow(this->arr[y][x] - mean, 2);
+            std += std::pow(this->row(y)[x] - mean, 2);
         }
     }
     std /= (double) total;
     std = std::sqrt(std);
 
-    normalize(mean, std);
+    normalize(mean, std < minStd ? minStd : std);
 }
 
 template<typename T>
 void
 Img<T>::normalize(T mean, T std) {
     for (size_t y = 0; y < this->height; y++) {
+        T *px = this->row(y);
         for (size_t x = 0; x < this->width; x++) {
-            this->arr[y][x] = (this->arr[y][x] - mean) / std;
+            px[x] = (px[x] - mean) / std;
         }
     }
 }
@@ -144,8 +209,9 @@ template<typename T>
 void
 Img<T>::rangeTo(T max) {
     for (int y = 0; y < height; ++y) {
+        T *px = this->row(y);
         for (int x = 0; x < width; ++x) {
-            this->arr[y][x] = this->arr[y][x] / max;
+            px[x] = px[x] / max;
         }
     }
 }
@@ -155,7 +221,7 @@ template<typename T>
     Img<T> integral(this->height - 1, this->width - 1);
     for (size_t y = 0; y < this->height - 1; ++y) {
         for (size_t x = 0; x < this->width - 1; ++x) {
-            integral.arr[y][x] = this->arr[y + 1][x + 1] - this->arr[y][x + 1] - this->arr[y + 1][x] + this->arr[y][x];
+            integral[y][x] = (*this)[y + 1][x + 1] - (*this)[y][x + 1] - (*this)[y + 1][x] + (*this)[y][x];
         }
     }
     return integral;
@@ -168,27 +234,12 @@ Img<T> Img<T>::resize(int h, int w) {
     cv::resize(mat, mat, cv::Size(w, h));
     for (int y = 0; y < h; y++) {
         for (int x = 0; x < w; x++) {
-            resized.arr[y][x] = mat.at<uchar>(y, x);
+            resized[y][x] = mat.at<uchar>(y, x);
         }
     }
     return resized;
 }
 
-template<typename T>
-Img<T> Img<T>::cropForIntegral(int x, int y, int w, int h) {
-    Img<T> cropped(h + 1, w + 1);
-    for (int row = 0; row < h + 1; ++row) {
-        for (int col = 0; col < w + 1; ++col) {
-            if (row + y >= this->height || col + x >= this->width) {
-                printf("ERR[OUT_OF_BOUNDS] Img::Crop (%d, %d)\n", row + y, col + x);
-                continue;
-            }
-            cropped.arr[row][col] = this->arr[row + y][col + x];
-        }
-    }
-    return cropped;
-}
-
 Scale
 scaled_size(Scale max, Scale size) {
     Scale scaled;
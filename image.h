@@ -3,10 +3,6 @@
 #include "constants.h"
 #include <opencv2/opencv.hpp>
 
-void gamma(cv::Mat &img, double gamma);
-
-cv::Mat gleam(cv::Mat &img);
-
 typedef struct {
     int width;
     int height;
@@ -14,13 +10,83 @@ typedef struct {
 
 Scale scaled_size(Scale max, Scale size);
 
+/**
+ * @brief Allocator handing out IMG_ALIGNMENT aligned blocks, so that every image buffer starts on a cache line.
+ */
+template<typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(IMG_ALIGNMENT)));
+    }
+
+    void deallocate(T *p, size_t) {
+        ::operator delete(p, std::align_val_t(IMG_ALIGNMENT));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U> &) const { return true; }
+
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+/**
+ * @brief Non-owning, strided view into row-major pixels. `T` may be const qualified.
+ */
+template<typename T>
+class ImgView {
+private:
+public:
+    T *data{};
+    int height{};
+    int width{};
+    size_t stride{};
+
+    ImgView() = default;
+
+    ImgView(T *data, int height, int width, size_t stride) : data(data), height(height), width(width), stride(stride) {}
+
+    template<typename U>
+    ImgView(const ImgView<U> &other) : data(other.data), height(other.height), width(other.width), stride(other.stride) {}
+
+    T *operator[](int y) const { return data + (size_t) y * stride; }
+
+    /**
+     * @brief View of the w x h region whose top left corner is (x, y). Does not copy.
+     */
+    [[nodiscard]] ImgView<T> window(int x, int y, int w, int h) const {
+        return {data + (size_t) y * stride + x, h, w, stride};
+    }
+};
+
+/**
+ * @brief Gamma correct a BGR image in place.
+ */
+void gamma(cv::Mat &img, double gamma);
+
+/**
+ * @brief Gamma corrected gray scale of a BGR image in one pass, written straight into `dst` (same size as `img`).
+ */
+template<typename T>
+void gleam(const cv::Mat &img, ImgView<T> dst);
+
+cv::Mat gleam(const cv::Mat &img);
+
 template<typename T>
 class Img {
 private:
 public:
     int height{};
     int width{};
-    std::vector<std::vector<T>> arr;
+    size_t stride{};
+    std::vector<T, AlignedAllocator<T>> data;
 
     Img(int height, int width);
 
@@ -28,6 +94,20 @@ public:
 
     void swap(Img<T> &other);
 
+    T *row(int y) { return data.data() + (size_t) y * stride; }
+
+    const T *row(int y) const { return data.data() + (size_t) y * stride; }
+
+    T *operator[](int y) { return row(y); }
+
+    const T *operator[](int y) const { return row(y); }
+
+    ImgView<T> view() { return {data.data(), height, width, stride}; }
+
+    [[nodiscard]] ImgView<const T> view() const { return {data.data(), height, width, stride}; }
+
+    operator ImgView<const T>() const { return view(); }
+
     /**
      * @brief Apply gamma and gleam.
      * @param image
@@ -37,6 +117,11 @@ public:
 
     [[nodiscard]]Img<T> toIntegral() const;
 
+    /**
+     * @brief Integral image and, in the same pass, the integral of squared pixels (written to `squared`).
+     */
+    [[nodiscard]]Img<T> toIntegral(Img<T> &squared) const;
+
     template<typename U>
     Img<U> cast();
 
@@ -46,7 +131,11 @@ public:
      */
     cv::Mat toMat();
 
-    void normalize();
+    /**
+     * @brief Subtract the image's own mean and divide by its own standard deviation, taking deviations below `minStd`
+     * as `minStd`.
+     */
+    void normalize(T minStd = 0);
 
     void normalize(T mean, T std);
 
@@ -61,19 +150,13 @@ public:
 
     Img<T> resize(int h, int w);
 
-    /**
-     * @brief Return cropForIntegral of image. Does not copy.
-     *
-     */
-    Img<T> cropForIntegral(int x, int y, int w, int h);
-
 };
 
 template<typename U>
 std::ostream &operator<<(std::ostream &os, const Img<U> &img) {
     for (size_t y = 0; y < img.height; y++) {
         for (size_t x = 0; x < img.width; x++) {
-            os << (double) img.arr[y][x] << '\t';
+            os << (double) img[y][x] << '\t';
         }
         os << std::endl;
     }
@@ -87,7 +170,7 @@ Img<U> Img<T>::cast() {
 
     for (size_t i = 0; i < height; ++i) {
         for (size_t j = 0; j < width; ++j) {
-            result.arr[i][j] = static_cast<U>(arr[i][j]);
+            result[i][j] = static_cast<U>(row(i)[j]);
         }
     }
 
@@ -111,3 +194,4 @@ class Img<long double>;
 
 typedef double ImgFlt;
 typedef Img<ImgFlt> ImgType;
+typedef ImgView<const ImgFlt> ImgViewType;
@@ -0,0 +1,155 @@
+#include "image_store.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+#include "parallel.h"
+#include "utils.h"
+
+#define IMAGE_STORE_VERSION 1
+
+static size_t
+pixels_offset(size_t images) {
+    size_t bytes = sizeof(ImageStoreHeader) + images * sizeof(ImageStoreEntry);
+    return (bytes + IMG_ALIGNMENT - 1) / IMG_ALIGNMENT * IMG_ALIGNMENT;
+}
+
+/**
+ * @brief Gray frame of an image file, scaled to fit IM_WIDTH x IM_HEIGHT. Photos much larger than the frame are
+ * decoded at 1/8, 1/4 or 1/2 of their resolution, which JPEG does without decoding every pixel.
+ */
+static ImgType
+load_frame(const std::string &path) {
+    cv::Mat image = cv::imread(path, cv::IMREAD_REDUCED_COLOR_8);
+    if (image.empty()) throw std::runtime_error("Could not read image: " + path);
+    Scale frame = scaled_size({IM_WIDTH, IM_HEIGHT}, {image.cols * 8, image.rows * 8});
+
+    const int flags[] = {cv::IMREAD_REDUCED_COLOR_8, cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_2,
+                         cv::IMREAD_COLOR};
+    const int factors[] = {8, 4, 2, 1};
+    int k = 0;
+    while (k < 3 && (image.cols * 8 / factors[k] < frame.width || image.rows * 8 / factors[k] < frame.height)) {
+        ++k;
+    }
+    if (k > 0) image = cv::imread(path, flags[k]);
+
+    frame = scaled_size({IM_WIDTH, IM_HEIGHT}, {image.cols, image.rows});
+    cv::Mat resized;
+    cv::resize(image, resized, {frame.width, frame.height});
+    ImgType im(resized.rows, resized.cols);
+    im.loadGrayScale(resized);
+    return im;
+}
+
+ImageStore::ImageStore(const std::string &path) {
+    this->path = path;
+    file = MappedFile::open(path);
+    header = reinterpret_cast<const ImageStoreHeader *>(file->data());
+    if (file->size() < sizeof(ImageStoreHeader) || std::memcmp(header->magic, "ODIS", 4) != 0 ||
+        header->version != IMAGE_STORE_VERSION || file->size() < pixels_offset(header->images)) {
+        throw std::runtime_error("Not a valid image store: " + path);
+    }
+    entries = reinterpret_cast<const ImageStoreEntry *>(file->data() + sizeof(ImageStoreHeader));
+    for (size_t i = 0; i < size(); ++i) {
+        if (entries[i].offset + (size_t) entries[i].height * entries[i].width > file->size()) {
+            throw std::runtime_error("Image store is truncated: " + path);
+        }
+    }
+}
+
+uint64_t
+ImageStore::key(const vec<std::string> &paths, StoreKind kind) {
+    uint32_t version = IMAGE_STORE_VERSION;
+    uint64_t hash = fnv1a(&version, sizeof version);
+    hash = fnv1a(&kind, sizeof kind, hash);
+    const int params[] = {FEATURE_SIZE, FACES_CROP_TOP, IM_WIDTH, IM_HEIGHT};
+    hash = fnv1a(params, sizeof params, hash);
+    for (const auto &p: paths) {
+        hash = fnv1a(p.data(), p.size() + 1, hash);
+        uint64_t bytes = std::filesystem::file_size(p);
+        auto modified = std::filesystem::last_write_time(p).time_since_epoch().count();
+        hash = fnv1a(&bytes, sizeof bytes, hash);
+        hash = fnv1a(&modified, sizeof modified, hash);
+    }
+    return hash;
+}
+
+shdptr<ImageStore>
+ImageStore::open(const std::string &path) {
+    return shdptr<ImageStore>(new ImageStore(path));
+}
+
+shdptr<ImageStore>
+ImageStore::build(const std::string &path, const vec<std::string> &paths, StoreKind kind) {
+    const size_t n = paths.size();
+    vec<vec<uchar>> pixels(n);
+    vec<ImageStoreEntry> entries(n);
+    ThreadPool::shared().parallelFor(n, 8, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ImgType im = kind == StoreFaces ? open_face(paths[i]) : load_frame(paths[i]);
+            entries[i].height = im.height;
+            entries[i].width = im.width;
+            pixels[i].reserve((size_t) im.height * im.width);
+            for (int y = 0; y < im.height; ++y) {
+                for (int x = 0; x < im.width; ++x) {
+                    pixels[i].push_back((uchar) im[y][x]);
+                }
+            }
+        }
+    });
+
+    ImageStoreHeader header{};
+    std::memcpy(header.magic, "ODIS", 4);
+    header.version = IMAGE_STORE_VERSION;
+    header.kind = kind;
+    header.key = key(paths, kind);
+    header.images = n;
+    size_t offset = pixels_offset(n);
+    for (size_t i = 0; i < n; ++i) {
+        entries[i].offset = offset;
+        offset += pixels[i].size();
+    }
+
+    auto out = MappedFile::create(path, offset);
+    std::memcpy(out->data(), &header, sizeof header);
+    std::memcpy(out->data() + sizeof header, entries.data(), n * sizeof(ImageStoreEntry));
+    for (size_t i = 0; i < n; ++i) {
+        std::memcpy(out->data() + entries[i].offset, pixels[i].data(), pixels[i].size());
+    }
+    out->commit();
+    return open(path);
+}
+
+shdptr<ImageStore>
+ImageStore::loadOrBuild(const std::string &dir, const vec<std::string> &paths, StoreKind kind) {
+    std::filesystem::create_directories(dir);
+    char name[64];
+    snprintf(name, sizeof name, "images_%016llx_%s.bin", (unsigned long long) key(paths, kind),
+             kind == StoreFaces ? "faces" : "frames");
+    std::string path = (std::filesystem::path(dir) / name).string();
+
+    if (std::filesystem::exists(path)) {
+        return open(path);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    printf("Building image store %s (%zu images)\n", path.c_str(), paths.size());
+    auto store = build(path, paths, kind);
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+    printf("Built image store in %lds\n", duration);
+    return store;
+}
+
+ImgType
+ImageStore::image(size_t i) const {
+    ImgType im(height(i), width(i));
+    const uchar *px = pixels(i);
+    for (int y = 0; y < im.height; ++y) {
+        for (int x = 0; x < im.width; ++x) {
+            im[y][x] = (ImgFlt) px[(size_t) y * im.width + x];
+        }
+    }
+    return im;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include "image.h"
+#include "mapped_file.h"
+
+enum StoreKind : uint32_t {
+    StoreFaces,     // open_face crops, FEATURE_SIZE x FEATURE_SIZE
+    StoreFrames     // whole images scaled to fit IM_WIDTH x IM_HEIGHT, the frame size the Runtime scans
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t images;
+} ImageStoreHeader;
+
+typedef struct {
+    uint64_t offset;    // of the pixels from the start of the file
+    int32_t height;
+    int32_t width;
+} ImageStoreEntry;
+
+/**
+ * @brief Gray scale images of a list of files, decoded and preprocessed once and kept in a memory mapped file.
+ *
+ * Image i belongs to paths[i]. Pixels are the 8 bit gray values loadGrayScale produces, so image() returns exactly
+ * what decoding the file again would. Files are named after a hash of the paths, their sizes and modification times,
+ * and the preprocessing parameters, so any change to the dataset builds a new store.
+ */
+class ImageStore {
+private:
+    shdptr<MappedFile> file;
+    const ImageStoreHeader *header = nullptr;
+    const ImageStoreEntry *entries = nullptr;
+
+    explicit ImageStore(const std::string &path);
+
+public:
+    std::string path;
+
+    static uint64_t key(const vec<std::string> &paths, StoreKind kind);
+
+    static shdptr<ImageStore> open(const std::string &path);
+
+    /**
+     * @brief Decode all `paths` in parallel on the shared thread pool and write them to `path`.
+     */
+    static shdptr<ImageStore> build(const std::string &path, const vec<std::string> &paths, StoreKind kind);
+
+    static shdptr<ImageStore> loadOrBuild(const std::string &dir, const vec<std::string> &paths, StoreKind kind);
+
+    [[nodiscard]] size_t size() const { return header->images; }
+
+    [[nodiscard]] int height(size_t i) const { return entries[i].height; }
+
+    [[nodiscard]] int width(size_t i) const { return entries[i].width; }
+
+    [[nodiscard]] const uchar *pixels(size_t i) const { return file->data() + entries[i].offset; }
+
+    [[nodiscard]] ImgType image(size_t i) const;
+};
@@ -0,0 +1,221 @@
+#include "integral_impl.h"
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+template<typename TIn, typename TAcc, typename TOut>
+struct ScalarOps {
+    typedef TIn In;
+    typedef TAcc Acc;
+    typedef TOut Out;
+    typedef TAcc V;
+    static constexpr int N = 1;
+
+    static V zero() { return 0; }
+
+    static V load(const In *p) { return (V) *p; }
+
+    static V mul(V a, V b) { return a * b; }
+
+    static V add(V a, V b) { return a + b; }
+
+    static V scan(V v) { return v; }
+
+    static V last(V v) { return v; }
+
+    static Acc first(V v) { return v; }
+
+    static void store(Out *dst, const Out *prev, V v) { *dst = *prev + (Out) v; }
+};
+
+#if defined(__x86_64__)
+
+struct Sse2U8Ops {
+    typedef uchar In;
+    typedef int32_t Acc;
+    typedef uint32_t Out;
+    typedef __m128i V;
+    static constexpr int N = 4;
+
+    static V zero() { return _mm_setzero_si128(); }
+
+    static V load(const In *p) {
+        int32_t packed;
+        std::memcpy(&packed, p, sizeof packed);
+        V z = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), z), z);
+    }
+
+    // Lanes hold values below 2^15, so a 16 bit multiply-add of each lane with itself is an exact square.
+    static V mul(V a, V b) { return _mm_madd_epi16(a, b); }
+
+    static V add(V a, V b) { return _mm_add_epi32(a, b); }
+
+    static V scan(V v) {
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        return _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    }
+
+    static V last(V v) { return _mm_shuffle_epi32(v, 0xFF); }
+
+    static Acc first(V v) { return _mm_cvtsi128_si32(v); }
+
+    static void store(Out *dst, const Out *prev, V v) {
+        _mm_storeu_si128((__m128i *) dst, _mm_add_epi32(_mm_loadu_si128((const __m128i *) prev), v));
+    }
+};
+
+struct Sse2U8SqOps : Sse2U8Ops {
+    typedef double Out;
+
+    static void store(Out *dst, const Out *prev, V v) {
+        _mm_storeu_pd(dst, _mm_add_pd(_mm_loadu_pd(prev), _mm_cvtepi32_pd(v)));
+        _mm_storeu_pd(dst + 2, _mm_add_pd(_mm_loadu_pd(prev + 2), _mm_cvtepi32_pd(_mm_shuffle_epi32(v, 0xEE))));
+    }
+};
+
+struct Sse2FloatOps {
+    typedef float In;
+    typedef float Acc;
+    typedef float Out;
+    typedef __m128 V;
+    static constexpr int N = 4;
+
+    static V zero() { return _mm_setzero_ps(); }
+
+    static V load(const In *p) { return _mm_loadu_ps(p); }
+
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+
+    static V scan(V v) {
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        return _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+    }
+
+    static V last(V v) { return _mm_shuffle_ps(v, v, 0xFF); }
+
+    static Acc first(V v) { return _mm_cvtss_f32(v); }
+
+    static void store(Out *dst, const Out *prev, V v) { _mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(prev), v)); }
+};
+
+struct Sse2DoubleOps {
+    typedef double In;
+    typedef double Acc;
+    typedef double Out;
+    typedef __m128d V;
+    static constexpr int N = 2;
+
+    static V zero() { return _mm_setzero_pd(); }
+
+    static V load(const In *p) { return _mm_loadu_pd(p); }
+
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+
+    static V scan(V v) { return _mm_add_pd(v, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(v), 8))); }
+
+    static V last(V v) { return _mm_unpackhi_pd(v, v); }
+
+    static Acc first(V v) { return _mm_cvtsd_f64(v); }
+
+    static void store(Out *dst, const Out *prev, V v) { _mm_storeu_pd(dst, _mm_add_pd(_mm_loadu_pd(prev), v)); }
+};
+
+#endif
+
+IntegralIsa
+detect_isa() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return IsaAvx2;
+    return IsaSse2;
+#else
+    return IsaScalar;
+#endif
+}
+
+const IntegralIsa SUPPORTED_ISA = detect_isa();
+IntegralIsa selected_isa = SUPPORTED_ISA;
+
+}
+
+IntegralIsa
+integral_isa() {
+    return selected_isa;
+}
+
+void
+set_integral_isa(IntegralIsa isa) {
+    selected_isa = isa <= SUPPORTED_ISA ? isa : SUPPORTED_ISA;
+}
+
+const char *
+integral_isa_name(IntegralIsa isa) {
+    switch (isa) {
+        case IsaScalar:
+            return "scalar";
+        case IsaSse2:
+            return "sse2";
+        case IsaAvx2:
+            return "avx2";
+    }
+    return "unknown";
+}
+
+void
+integral(const uchar *src, size_t srcStride, int height, int width,
+         uint32_t *sum, size_t sumStride, double *sqsum, size_t sqsumStride) {
+    switch (selected_isa) {
+#if defined(__x86_64__)
+        case IsaAvx2:
+            return integral_avx2(src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+        case IsaSse2:
+            return integral_image<Sse2U8Ops, Sse2U8SqOps>(src, srcStride, height, width,
+                                                          sum, sumStride, sqsum, sqsumStride);
+#endif
+        default:
+            return integral_image<ScalarOps<uchar, uint32_t, uint32_t>, ScalarOps<uchar, int32_t, double>>(
+                    src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+    }
+}
+
+void
+integral(const float *src, size_t srcStride, int height, int width,
+         float *sum, size_t sumStride, float *sqsum, size_t sqsumStride) {
+    switch (selected_isa) {
+#if defined(__x86_64__)
+        case IsaAvx2:
+            return integral_avx2(src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+        case IsaSse2:
+            return integral_image<Sse2FloatOps, Sse2FloatOps>(src, srcStride, height, width,
+                                                              sum, sumStride, sqsum, sqsumStride);
+#endif
+        default:
+            return integral_image<ScalarOps<float, float, float>, ScalarOps<float, float, float>>(
+                    src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+    }
+}
+
+void
+integral(const double *src, size_t srcStride, int height, int width,
+         double *sum, size_t sumStride, double *sqsum, size_t sqsumStride) {
+    switch (selected_isa) {
+#if defined(__x86_64__)
+        case IsaAvx2:
+            return integral_avx2(src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+        case IsaSse2:
+            return integral_image<Sse2DoubleOps, Sse2DoubleOps>(src, srcStride, height, width,
+                                                                sum, sumStride, sqsum, sqsumStride);
+#endif
+        default:
+            return integral_image<ScalarOps<double, double, double>, ScalarOps<double, double, double>>(
+                    src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+    }
+}
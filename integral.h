@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include "constants.h"
+
+enum IntegralIsa {
+    IsaScalar,
+    IsaSse2,
+    IsaAvx2
+};
+
+/**
+ * @brief Kernel used by integral(). Picked from the CPU on first use.
+ */
+IntegralIsa integral_isa();
+
+/**
+ * @brief Force a kernel, e.g. for benchmarking. Falls back to the best supported one if `isa` is not available.
+ */
+void set_integral_isa(IntegralIsa isa);
+
+const char *integral_isa_name(IntegralIsa isa);
+
+/**
+ * @brief Integral image of an 8 bit gray scale image.
+ * @param sum (height + 1) x (width + 1) output, first row and column are written as 0.
+ * @param sqsum Optional (height + 1) x (width + 1) integral of squared pixels, computed in the same pass. May be null.
+ */
+void integral(const uchar *src, size_t srcStride, int height, int width,
+              uint32_t *sum, size_t sumStride, double *sqsum = nullptr, size_t sqsumStride = 0);
+
+void integral(const float *src, size_t srcStride, int height, int width,
+              float *sum, size_t sumStride, float *sqsum = nullptr, size_t sqsumStride = 0);
+
+void integral(const double *src, size_t srcStride, int height, int width,
+              double *sum, size_t sumStride, double *sqsum = nullptr, size_t sqsumStride = 0);
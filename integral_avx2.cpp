@@ -0,0 +1,145 @@
+// Compiled with -mavx2, only called after integral.cpp has checked the CPU supports it.
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+#include "integral_impl.h"
+
+namespace {
+
+// Inclusive prefix sum over 8 32 bit lanes: scan each 128 bit half, then carry the low half's total into the high half.
+inline __m256i
+scan_epi32(__m256i v) {
+    v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+    v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+    __m256i t = _mm256_shuffle_epi32(v, 0xFF);
+    return _mm256_add_epi32(v, _mm256_permute2x128_si256(t, t, 0x08));
+}
+
+struct Avx2U8Ops {
+    typedef uchar In;
+    typedef int32_t Acc;
+    typedef uint32_t Out;
+    typedef __m256i V;
+    static constexpr int N = 8;
+
+    static V zero() { return _mm256_setzero_si256(); }
+
+    static V load(const In *p) { return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p)); }
+
+    static V mul(V a, V b) { return _mm256_mullo_epi32(a, b); }
+
+    static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+
+    static V scan(V v) { return scan_epi32(v); }
+
+    static V last(V v) {
+        __m256i t = _mm256_shuffle_epi32(v, 0xFF);
+        return _mm256_permute2x128_si256(t, t, 0x11);
+    }
+
+    static Acc first(V v) { return _mm256_cvtsi256_si32(v); }
+
+    static void store(Out *dst, const Out *prev, V v) {
+        _mm256_storeu_si256((__m256i *) dst, _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) prev), v));
+    }
+};
+
+struct Avx2U8SqOps : Avx2U8Ops {
+    typedef double Out;
+
+    static void store(Out *dst, const Out *prev, V v) {
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+        _mm256_storeu_pd(dst, _mm256_add_pd(_mm256_loadu_pd(prev), lo));
+        _mm256_storeu_pd(dst + 4, _mm256_add_pd(_mm256_loadu_pd(prev + 4), hi));
+    }
+};
+
+struct Avx2FloatOps {
+    typedef float In;
+    typedef float Acc;
+    typedef float Out;
+    typedef __m256 V;
+    static constexpr int N = 8;
+
+    static V zero() { return _mm256_setzero_ps(); }
+
+    static V load(const In *p) { return _mm256_loadu_ps(p); }
+
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+
+    static V scan(V v) {
+        v = _mm256_add_ps(v, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(v), 4)));
+        v = _mm256_add_ps(v, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(v), 8)));
+        __m256 t = _mm256_permute_ps(v, 0xFF);
+        return _mm256_add_ps(v, _mm256_permute2f128_ps(t, t, 0x08));
+    }
+
+    static V last(V v) {
+        __m256 t = _mm256_permute_ps(v, 0xFF);
+        return _mm256_permute2f128_ps(t, t, 0x11);
+    }
+
+    static Acc first(V v) { return _mm256_cvtss_f32(v); }
+
+    static void store(Out *dst, const Out *prev, V v) {
+        _mm256_storeu_ps(dst, _mm256_add_ps(_mm256_loadu_ps(prev), v));
+    }
+};
+
+struct Avx2DoubleOps {
+    typedef double In;
+    typedef double Acc;
+    typedef double Out;
+    typedef __m256d V;
+    static constexpr int N = 4;
+
+    static V zero() { return _mm256_setzero_pd(); }
+
+    static V load(const In *p) { return _mm256_loadu_pd(p); }
+
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+
+    static V scan(V v) {
+        v = _mm256_add_pd(v, _mm256_castsi256_pd(_mm256_slli_si256(_mm256_castpd_si256(v), 8)));
+        __m256d t = _mm256_permute_pd(v, 0xF);
+        return _mm256_add_pd(v, _mm256_permute2f128_pd(t, t, 0x08));
+    }
+
+    static V last(V v) {
+        __m256d t = _mm256_permute_pd(v, 0xF);
+        return _mm256_permute2f128_pd(t, t, 0x11);
+    }
+
+    static Acc first(V v) { return _mm256_cvtsd_f64(v); }
+
+    static void store(Out *dst, const Out *prev, V v) {
+        _mm256_storeu_pd(dst, _mm256_add_pd(_mm256_loadu_pd(prev), v));
+    }
+};
+
+}
+
+void
+integral_avx2(const uchar *src, size_t srcStride, int height, int width,
+              uint32_t *sum, size_t sumStride, double *sqsum, size_t sqsumStride) {
+    integral_image<Avx2U8Ops, Avx2U8SqOps>(src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+}
+
+void
+integral_avx2(const float *src, size_t srcStride, int height, int width,
+              float *sum, size_t sumStride, float *sqsum, size_t sqsumStride) {
+    integral_image<Avx2FloatOps, Avx2FloatOps>(src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+}
+
+void
+integral_avx2(const double *src, size_t srcStride, int height, int width,
+              double *sum, size_t sumStride, double *sqsum, size_t sqsumStride) {
+    integral_image<Avx2DoubleOps, Avx2DoubleOps>(src, srcStride, height, width, sum, sumStride, sqsum, sqsumStride);
+}
+
+#endif
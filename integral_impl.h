@@ -0,0 +1,64 @@
+#pragma once
+
+// Shared by the integral kernels of every instruction set. Only include from integral*.cpp: the
+// templates are instantiated with per-translation-unit Ops types that are compiled for different ISAs.
+
+#include <cstring>
+#include "integral.h"
+
+/**
+ * @brief One row of the integral: an in-register prefix sum of the source row added onto the previous output row.
+ *
+ * Ops describes one vector type: N lanes, load (with conversion to the accumulator type), mul, add,
+ * an inclusive lane scan, broadcast of the last lane and a store that adds the previous output row.
+ */
+template<typename Ops, bool Square>
+inline void
+integral_row(const typename Ops::In *src, int width, const typename Ops::Out *prev, typename Ops::Out *dst) {
+    typename Ops::V carry = Ops::zero();
+    int x = 0;
+    for (; x + Ops::N <= width; x += Ops::N) {
+        typename Ops::V v = Ops::load(src + x);
+        if (Square) v = Ops::mul(v, v);
+        v = Ops::add(Ops::scan(v), carry);
+        Ops::store(dst + x + 1, prev + x + 1, v);
+        carry = Ops::last(v);
+    }
+    typename Ops::Acc run = Ops::first(carry);
+    for (; x < width; ++x) {
+        auto px = (typename Ops::Acc) src[x];
+        run += Square ? px * px : px;
+        dst[x + 1] = prev[x + 1] + (typename Ops::Out) run;
+    }
+    dst[0] = 0;
+}
+
+template<typename SumOps, typename SqOps>
+inline void
+integral_image(const typename SumOps::In *src, size_t srcStride, int height, int width,
+               typename SumOps::Out *sum, size_t sumStride, typename SqOps::Out *sqsum, size_t sqsumStride) {
+    std::memset(sum, 0, sizeof(*sum) * (width + 1));
+    if (sqsum) std::memset(sqsum, 0, sizeof(*sqsum) * (width + 1));
+
+    // Both outputs are produced while the source row is still in L1.
+    for (int y = 0; y < height; ++y) {
+        const typename SumOps::In *row = src + y * srcStride;
+        integral_row<SumOps, false>(row, width, sum + y * sumStride, sum + (y + 1) * sumStride);
+        if (sqsum) {
+            integral_row<SqOps, true>(row, width, sqsum + y * sqsumStride, sqsum + (y + 1) * sqsumStride);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+
+void integral_avx2(const uchar *src, size_t srcStride, int height, int width,
+                   uint32_t *sum, size_t sumStride, double *sqsum, size_t sqsumStride);
+
+void integral_avx2(const float *src, size_t srcStride, int height, int width,
+                   float *sum, size_t sumStride, float *sqsum, size_t sqsumStride);
+
+void integral_avx2(const double *src, size_t srcStride, int height, int width,
+                   double *sum, size_t sumStride, double *sqsum, size_t sqsumStride);
+
+#endif
@@ -1,18 +1,17 @@
 #include "learner.h"
 
+#include <unordered_set>
 #include <utility>
 
 
 std::string
 WeakClassifier::csv() const {
-    std::string out = std::to_string(this->threshold);
-    out += ",";
-    out += std::to_string(this->polarity);
-    out += ",";
-    out += std::to_string(this->alpha);
-    out += ",";
-    out += this->feat->csv();
-    return out;
+    // Enough digits to read back the same doubles, so a cascade loaded from its files decides exactly as trained.
+    char values[80];
+    snprintf(values, sizeof values, "%.17g,%d,%.17g,", this->threshold, this->polarity, this->alpha);
+    char reject[32];
+    snprintf(reject, sizeof reject, ",%.17g", this->rejectThreshold);
+    return values + this->feat->csv() + reject;
 }
 
 WeakClassifier
@@ -24,14 +23,16 @@ load_weak_classifier(const std::string &csv) {
         parts.push_back(part);
     }
 
-    flt threshold = std::stof(parts[0]);
+    flt threshold = std::stod(parts[0]);
     int polarity = std::stoi(parts[1]);
-    flt alpha = std::stof(parts[2]);
+    flt alpha = std::stod(parts[2]);
     std::string feat_name = parts[3];
     size_t x = std::stoi(parts[4]);
     size_t y = std::stoi(parts[5]);
     size_t w = std::stoi(parts[6]);
     size_t h = std::stoi(parts[7]);
+    // Files written before soft cascades have no rejection threshold.
+    flt reject = parts.size() > 8 ? std::stod(parts[8]) : -std::numeric_limits<flt>::infinity();
 
     shdptr<Feature> feat;
     if (feat_name == "2h") {
@@ -48,7 +49,7 @@ load_weak_classifier(const std::string &csv) {
         throw std::runtime_error("Unknown feature name: " + feat_name);
     }
 
-    return {threshold, polarity, alpha, feat};
+    return {threshold, polarity, alpha, feat, reject};
 }
 
 void
@@ -81,20 +82,75 @@ print_weak_classifiers(const std::vector<WeakClassifier> &weakClassifiers) {
     }
 }
 
-Learner::Learner(std::vector<shdptr<ImgType>> normalizedIntegrals,
+Learner::Learner(shdptr<SampleStore> store,
+                 vec<uint32_t> cols,
                  std::vector<int> lbls,
                  shdptr<std::vector<shdptr<Feature>>> feats) {
-    integrals = std::move(normalizedIntegrals);
-
+    samples = std::move(store);
+    columns = std::move(cols);
     labels = std::move(lbls);
+    if (labels.size() != columns.size()) {
+        throw std::runtime_error("Every sample of the learner needs a label");
+    }
+    for (uint32_t c: columns) {
+        if (c >= samples->size()) throw std::runtime_error("Sample index out of the store: " + samples->path);
+    }
 
     initWeights();
 
     features = std::move(feats);
+    table = FeatureTable(*features, samples->height(), samples->width(), samples->stride());
 
     weakClassifiers = std::make_shared<classifiervec>();
 }
 
+void
+Learner::useResponses(shdptr<ResponseMatrix> matrix) {
+    if (matrix->features() != features->size() || matrix->samples() != samples->size() ||
+        matrix->fileKey() != ResponseMatrix::key(table, *samples, matrix->format())) {
+        throw std::runtime_error("Response matrix does not match the learner: " + matrix->path);
+    }
+    responses = std::move(matrix);
+}
+
+void
+Learner::useSortedIndex(shdptr<SortedIndex> index) {
+    if (!responses || index->fileKey() != responses->fileKey()) {
+        throw std::runtime_error("Sorted index does not match the response matrix: " + index->path);
+    }
+    sorted = std::move(index);
+    search = SearchSorted;
+}
+
+void
+Learner::useBins(shdptr<ResponseBins> quantized) {
+    if (!responses || quantized->fileKey() != responses->fileKey()) {
+        throw std::runtime_error("Response bins do not match the response matrix: " + quantized->path);
+    }
+    bins = std::move(quantized);
+    search = SearchBinned;
+}
+
+void
+Learner::useWeightTrimming(flt fraction) {
+    if (fraction <= 0 || fraction > 1) {
+        throw std::runtime_error("Weight trimming fraction must be in (0, 1], got " + std::to_string(fraction));
+    }
+    trimFraction = fraction;
+}
+
+void
+Learner::useFeatureSampling(const SamplingOptions &options) {
+    if (options.mode == SampleRandom && (options.fraction <= 0 || options.fraction > 1)) {
+        throw std::runtime_error("Feature fraction must be in (0, 1], got " + std::to_string(options.fraction));
+    }
+    if (options.mode == SampleCoarseToFine && (options.step < 1 || options.candidates < 1)) {
+        throw std::runtime_error("Coarse to fine search needs a step and candidates of at least 1");
+    }
+    sampling = options;
+    coarse.clear();
+}
+
 void
 Learner::initWeights() {
     int num_faces, num_bgs;
@@ -125,23 +181,23 @@ Learner::normalizeWeights() {
 }
 
 int
-Learner::weakClassifier(const ImgType &img, shdptr<Feature> feat, flt threshold, int polarity) {
-    auto r = feat->diff(img);
-    if ((flt) polarity * r < (flt) polarity * threshold) {
-        return 1;
-    } else {
-        return 0;
-    }
+Learner::weakClassifier(ImgViewType img, shdptr<Feature> feat, flt threshold, int polarity) {
+    return classify(feat->diff(img), threshold, polarity);
 }
 
 int
-inline
-Learner::runWeakClassifier(const ImgType &img, const WeakClassifier &weakClassifier_) {
+Learner::runWeakClassifier(ImgViewType img, const WeakClassifier &weakClassifier_) {
     return weakClassifier(img, weakClassifier_.feat, weakClassifier_.threshold, weakClassifier_.polarity);
 }
 
+int
+Learner::runWeakClassifier(const SampleStore &store, size_t i, const WeakClassifier &weakClassifier_,
+                           const FeatureTable &table, size_t f) {
+    return classify(store.response(table, f, i), weakClassifier_.threshold, weakClassifier_.polarity);
+}
+
 StrongClassifierResult
-Learner::strongClassifier(const ImgType &img, const classifiervec &weakClassifiers) {
+Learner::strongClassifier(ImgViewType img, const classifiervec &weakClassifiers) {
     flt sum_hypotheses = 0;
     flt sum_alphas = 0;
     for (const auto &c: weakClassifiers) {
@@ -151,162 +207,427 @@ Learner::strongClassifier(const ImgType &img, const classifiervec &weakClassifie
     return {sum_alphas, sum_hypotheses, std::abs(sum_hypotheses / sum_alphas)};
 }
 
-RunningSums
-Learner::buildRunningSums() {
-    flt s_minus, s_plus, t_minus, t_plus;
-    s_minus = s_plus = t_minus = t_plus = 0.0;
-    fltvec s_minuses, s_pluses;
-    s_minuses.reserve(integrals.size());
-    s_pluses.reserve(integrals.size());
-
-    for (int i = 0; i < integrals.size(); ++i) {
-        auto label = labels[i];
-        auto weight = weights[i];
-
-        if (label == 0) {
-            s_minus += weight;
-            t_minus += weight;
-        } else {
-            s_plus += weight;
-            t_plus += weight;
-        }
-        s_minuses.push_back(s_minus);
-        s_pluses.push_back(s_plus);
-    }
-    return {t_minus, t_plus, s_minuses, s_pluses};
-}
-
-ThresholdPolarity
-Learner::findBestThreshold(const fltvec &results, const RunningSums &runningSums) {
-    flt min_error = std::numeric_limits<flt>::max();
-    flt min_z = 0;
-    int polarity = 0;
-
-    for (int i = 0; i < results.size(); i++) {
-        flt result = results[i];
-        flt s_m = runningSums.s_minuses[i];
-        flt s_p = runningSums.s_pluses[i];
-        flt err1 = s_p + (runningSums.t_minus - s_m);
-        flt err2 = s_m + (runningSums.t_plus - s_p);
-        if (err1 < min_error) {
-            min_error = err1;
-            min_z = result;
-            polarity = -1;
-        } else {
-            min_error = err2;
-            min_z = result;
-            polarity = 1;
-        }
+FeatureTable
+Learner::compile(const classifiervec &weakClassifiers, const SampleStore &store) {
+    vec<shdptr<Feature>> feats;
+    feats.reserve(weakClassifiers.size());
+    for (const auto &c: weakClassifiers) {
+        feats.push_back(c.feat);
+    }
+    return {feats, store.height(), store.width(), store.stride()};
+}
+
+StrongClassifierResult
+Learner::strongClassifier(const SampleStore &store, size_t i, const classifiervec &weakClassifiers,
+                          const FeatureTable &table) {
+    flt sum_hypotheses = 0;
+    flt sum_alphas = 0;
+    for (size_t k = 0; k < weakClassifiers.size(); ++k) {
+        const auto &c = weakClassifiers[k];
+        sum_hypotheses += c.alpha * (flt) runWeakClassifier(store, i, c, table, k);
+        sum_alphas += c.alpha;
     }
-    return {min_z, polarity};
+    return {sum_alphas, sum_hypotheses, std::abs(sum_hypotheses / sum_alphas)};
 }
 
-ThresholdPolarity
-Learner::determineThresholdPolarity(const fltvec &results) {
-    std::vector<int> sorted(results.size());
-    std::iota(sorted.begin(), sorted.end(), 0);
-    std::sort(sorted.begin(), sorted.end(), [&results](int i1, int i2) { return results[i1] < results[i2]; });
+ClassifierResult
+Learner::applyFeature(size_t f) const {
+    const size_t n = active.size();
+    fltvec results(n);
+    for (size_t k = 0; k < n; ++k) {
+        results[k] = response(f, active[k]);
+    }
+
+    // Ties in the same order as SortedIndex, so both searches pick the same threshold.
+    vec<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&results](uint32_t a, uint32_t b) {
+        return results[a] < results[b] || (results[a] == results[b] && a < b);
+    });
+
+    ClassifierResult result = scanThresholds(
+            n,
+            [&](size_t k) { return results[order[k]]; },
+            [&](size_t k) {
+                uint32_t i = active[order[k]];
+                return labels[i] == 1 ? weights[i] : -weights[i];
+            },
+            totalPlus, totalMinus);
+    result.feat = (*features)[f];
+    return result;
+}
 
-    for (int i = 0; i < sorted.size(); ++i) {
-        if (sorted[i] == i) continue;
-        std::swap(labels[i], labels[sorted[i]]);
-        std::swap(weights[i], weights[sorted[i]]);
-        integrals[i].swap(integrals[sorted[i]]);
+void
+Learner::prepareRound() {
+    active.resize(columns.size());
+    std::iota(active.begin(), active.end(), 0);
+    if (trimFraction < 1) {
+        // Heaviest first, ties by index so the subset does not depend on the sort implementation.
+        std::sort(active.begin(), active.end(), [this](uint32_t a, uint32_t b) {
+            return weights[a] > weights[b] || (weights[a] == weights[b] && a < b);
+        });
+        flt kept = 0;
+        size_t n = 0;
+        while (n < active.size() && kept < trimFraction) {
+            kept += weights[active[n++]];
+        }
+        active.resize(n);
+        std::sort(active.begin(), active.end());
     }
 
-    RunningSums sums = buildRunningSums();
+    totalPlus = totalMinus = 0;
+    for (uint32_t i: active) {
+        if (labels[i] == 1) totalPlus += weights[i];
+        else totalMinus += weights[i];
+    }
 
-    ThresholdPolarity best_threshold = findBestThreshold(results, sums);
-    return best_threshold;
+    if (search != SearchSorted) return;
+    columnWeights.assign(responses->samples(), 0);
+    for (uint32_t i: active) {
+        columnWeights[columns[i]] = labels[i] == 1 ? weights[i] : -weights[i];
+    }
 }
 
 ClassifierResult
-Learner::applyFeature(shdptr<Feature> feature) {
-    fltvec results;
-    std::fill_n(std::back_inserter(results), integrals.size(), 0);
+Learner::applyFeatureSorted(size_t f) const {
+    const uint32_t *order = sorted->row(f);
+    const ResponseMatrix &matrix = *responses;
+    ClassifierResult result = scanThresholds(
+            matrix.samples(),
+            [&](size_t k) { return matrix.at(f, order[k]); },
+            [&](size_t k) { return columnWeights[order[k]]; },
+            totalPlus, totalMinus);
+    result.feat = (*features)[f];
+    return result;
+}
 
-#pragma omp parallel for
-    for (int i = 0; i < integrals.size(); ++i) {
-        results[i] = feature->diff(*integrals[i]);
+ClassifierResult
+Learner::applyFeatureBinned(size_t f, fltvec &histogram) const {
+    const uint32_t num_bins = bins->bins();
+    // weights of faces in [0, num_bins), of backgrounds in [num_bins, 2 * num_bins)
+    histogram.assign(2 * num_bins, 0);
+    for (uint32_t i: active) {
+        uint32_t b = bins->bin(f, columns[i]);
+        if (labels[i] == 1) histogram[b] += weights[i];
+        else histogram[num_bins + b] += weights[i];
     }
 
-    ThresholdPolarity result = determineThresholdPolarity(results);
+    ClassifierResult best{0, 0, std::numeric_limits<flt>::max(), (*features)[f]};
+    flt s_plus = 0, s_minus = 0;
+    for (uint32_t b = 0; b + 1 < num_bins; ++b) {
+        s_plus += histogram[b];
+        s_minus += histogram[num_bins + b];
+        const flt edge = bins->edge(f, b);
+        if (std::isinf(edge)) break;
+
+        // polarity 1: bins up to b are faces, i.e. response < edge
+        flt err = s_minus + (totalPlus - s_plus);
+        if (err < best.classification_error) best = {edge, 1, err, best.feat};
+
+        // polarity -1: bins after b are faces, i.e. response >= edge, which is > the double just below it
+        err = s_plus + (totalMinus - s_minus);
+        if (err < best.classification_error) {
+            best = {std::nextafter(edge, -std::numeric_limits<flt>::infinity()), -1, err, best.feat};
+        }
+    }
+    return best;
+}
 
-    flt classification_error = 0.0;
-    for (int i = 0; i < integrals.size(); ++i) {
-        auto im = integrals[i];
-        auto label = labels[i];
-        auto weight = weights[i];
+ClassifierResult
+Learner::searchFeature(size_t f, fltvec &histogram) const {
+    switch (search) {
+        case SearchSorted:
+            return applyFeatureSorted(f);
+        case SearchBinned:
+            return applyFeatureBinned(f, histogram);
+        case SearchExact:
+            break;
+    }
+    return applyFeature(f);
+}
+
+Learner::FeatureChoice
+Learner::searchFeatures(const vec<uint32_t> &candidates, fltvec *errors, const RoundProgress &progress) const {
+    const size_t FEATURE_CHUNK = 64;
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t workers = pool.size();
+
+    // Every worker keeps its own best, merged below by (error, feature index) so the result does not depend on
+    // which worker evaluated which feature.
+    vec<FeatureChoice> bests(workers, {{0, 0, std::numeric_limits<flt>::max(), nullptr}, features->size()});
+
+    std::mutex print;
+    std::atomic<size_t> evaluated{0};
+    std::atomic<flt> reported{std::numeric_limits<flt>::max()};
+
+    pool.parallelFor(candidates.size(), FEATURE_CHUNK, [&](size_t worker, size_t begin, size_t end) {
+        fltvec histogram;
+        for (size_t k = begin; k < end; ++k) {
+            const size_t i = candidates[k];
+            ClassifierResult result = searchFeature(i, histogram);
+            if (errors) (*errors)[k] = result.classification_error;
+            FeatureChoice &local = bests[worker];
+            if (result.classification_error < local.result.classification_error ||
+                (result.classification_error == local.result.classification_error && i < local.feature)) {
+                local = {result, i};
+            }
+
+            size_t done = ++evaluated;
+            if (result.classification_error >= reported.load() && done % STATUS_EVERY != 0) continue;
+
+            std::lock_guard<std::mutex> lock(print);
+            bool improved = result.classification_error < reported.load();
+            if (improved) reported = result.classification_error;
+
+            auto now = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - progress.start).count();
+            auto total_duration = std::chrono::duration_cast<std::chrono::seconds>(now - progress.totalStart).count();
+            auto features_perc = 100.0 * (flt) done / (flt) candidates.size();
+            printf("\t[%lds]\t(%d/%d)\t| Stage: [%ldms] %.2f%% (%zu/%zu)", total_duration, progress.round + 1,
+                   progress.rounds, duration, features_perc, done, candidates.size());
+            if (improved)
+                printf(" \tError improved to %f\t%s", result.classification_error, result.feat->str().c_str());
+
+            size_t run = progress.evaluated + done;
+            auto remaining_time = ((flt) total_duration / (flt) run) * ((flt) progress.total - (flt) run);
+            printf(" \tRemaining time: %lds", (long) std::max<flt>(remaining_time, 0));
 
-        auto h = weakClassifier(*im, feature, result.threshold, result.polarity);
-        classification_error += weight * std::abs(h - label);
+            std::cout << std::endl;
+        }
+    }, workers);
+
+    FeatureChoice best = bests[0];
+    for (size_t w = 1; w < workers; ++w) {
+        if (bests[w].result.classification_error < best.result.classification_error ||
+            (bests[w].result.classification_error == best.result.classification_error &&
+             bests[w].feature < best.feature)) {
+            best = bests[w];
+        }
     }
+    return best;
+}
 
-    return {result.threshold, result.polarity, classification_error, feature};
+vec<uint32_t>
+Learner::roundCandidates(int round) const {
+    vec<uint32_t> all(features->size());
+    std::iota(all.begin(), all.end(), 0);
+    if (sampling.mode != SampleRandom) return all;
+
+    // Seeded per round, so a round picks the same features however training got there.
+    std::seed_seq seq{sampling.seed, (uint32_t) round};
+    std::mt19937 gen(seq);
+    const auto n = (size_t) std::ceil(sampling.fraction * (flt) all.size());
+    for (size_t k = 0; k < n; ++k) {
+        std::uniform_int_distribution<size_t> pick(k, all.size() - 1);
+        std::swap(all[k], all[pick(gen)]);
+    }
+    all.resize(n);
+    std::sort(all.begin(), all.end());
+    return all;
 }
 
-shdptr<classifiervec>
-Learner::train(int numWeakClassifiers) {
-    const size_t TOTAL_CLASSIFIERS = numWeakClassifiers * features->size();
-    size_t run_classifiers = 0;
+/**
+ * @brief Step of feature widths and heights of a type: its number of cells.
+ */
+static XY
+feature_unit(FeatureType type) {
+    switch (type) {
+        case FeatType2h:
+            return {HaarPattern<FeatType2h>::NX, HaarPattern<FeatType2h>::NY};
+        case FeatType2v:
+            return {HaarPattern<FeatType2v>::NX, HaarPattern<FeatType2v>::NY};
+        case FeatType3h:
+            return {HaarPattern<FeatType3h>::NX, HaarPattern<FeatType3h>::NY};
+        case FeatType3v:
+            return {HaarPattern<FeatType3v>::NX, HaarPattern<FeatType3v>::NY};
+        case FeatType4:
+            return {HaarPattern<FeatType4>::NX, HaarPattern<FeatType4>::NY};
+    }
+    return {1, 1};
+}
 
-    auto total_start = std::chrono::high_resolution_clock::now();
-    for (int t = (int) weakClassifiers->size(); t < numWeakClassifiers; t++) {
-        auto start = std::chrono::high_resolution_clock::now();
+static uint64_t
+geometry_key(FeatureType type, long x, long y, long w, long h) {
+    return (uint64_t) type << 32 | (uint64_t) x << 24 | (uint64_t) y << 16 | (uint64_t) w << 8 | (uint64_t) h;
+}
 
-        normalizeWeights();
+void
+Learner::buildCoarseGrid() {
+    coarse.clear();
+    geometry.clear();
+    for (uint32_t i = 0; i < features->size(); ++i) {
+        const Feature &feat = *(*features)[i];
+        XY unit = feature_unit(feat.type());
+        geometry[geometry_key(feat.type(), (long) feat.x, (long) feat.y, (long) feat.width, (long) feat.height)] = i;
+        if (feat.x % sampling.step == 0 && feat.y % sampling.step == 0 &&
+            (feat.width / unit.x - 1) % sampling.step == 0 && (feat.height / unit.y - 1) % sampling.step == 0) {
+            coarse.push_back(i);
+        }
+    }
+}
 
-        int status = STATUS_EVERY;
+long
+Learner::featureIndex(const Feature &feat) {
+    if (geometry.empty()) {
+        for (uint32_t i = 0; i < features->size(); ++i) {
+            const Feature &f = *(*features)[i];
+            geometry[geometry_key(f.type(), (long) f.x, (long) f.y, (long) f.width, (long) f.height)] = i;
+        }
+    }
+    auto it = geometry.find(geometry_key(feat.type(), (long) feat.x, (long) feat.y, (long) feat.width,
+                                         (long) feat.height));
+    return it == geometry.end() ? -1 : (long) it->second;
+}
 
-        ClassifierResult best{0, 0, std::numeric_limits<flt>::max(), nullptr};
+vec<uint32_t>
+Learner::refineCandidates(const vec<uint32_t> &seeds) const {
+    const long r = sampling.step - 1;
+    std::unordered_set<uint32_t> seen;
+    vec<uint32_t> out;
+    for (uint32_t s: seeds) {
+        const Feature &feat = *(*features)[s];
+        XY unit = feature_unit(feat.type());
+        for (long dw = -r; dw <= r; ++dw) {
+            for (long dh = -r; dh <= r; ++dh) {
+                for (long dx = -r; dx <= r; ++dx) {
+                    for (long dy = -r; dy <= r; ++dy) {
+                        long x = (long) feat.x + dx, y = (long) feat.y + dy;
+                        long w = (long) feat.width + dw * unit.x, h = (long) feat.height + dh * unit.y;
+                        if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > 255 || h > 255 || x > 255 || y > 255) continue;
+                        auto it = geometry.find(geometry_key(feat.type(), x, y, w, h));
+                        if (it != geometry.end() && seen.insert(it->second).second) out.push_back(it->second);
+                    }
+                }
+            }
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+Learner::FeatureChoice
+Learner::searchRound(const RoundProgress &progress, size_t &evaluated) {
+    if (sampling.mode != SampleCoarseToFine) {
+        vec<uint32_t> candidates = roundCandidates(progress.round);
+        evaluated = candidates.size();
+        return searchFeatures(candidates, nullptr, progress);
+    }
 
-        size_t i = 0;
-        for (const auto &feat: *features) {
-            --status;
-            ++run_classifiers;
+    if (coarse.empty()) buildCoarseGrid();
+    fltvec errors(coarse.size());
+    FeatureChoice best = searchFeatures(coarse, &errors, progress);
+
+    vec<uint32_t> order(coarse.size());
+    std::iota(order.begin(), order.end(), 0);
+    size_t keep = std::min(sampling.candidates, order.size());
+    std::partial_sort(order.begin(), order.begin() + (long) keep, order.end(), [&errors](uint32_t a, uint32_t b) {
+        return errors[a] < errors[b] || (errors[a] == errors[b] && a < b);
+    });
+    vec<uint32_t> seeds;
+    for (size_t k = 0; k < keep; ++k) {
+        seeds.push_back(coarse[order[k]]);
+    }
+
+    vec<uint32_t> fine = refineCandidates(seeds);
+    RoundProgress fine_progress = progress;
+    fine_progress.evaluated += coarse.size();
+    FeatureChoice refined = searchFeatures(fine, nullptr, fine_progress);
+    evaluated = coarse.size() + fine.size();
 
-            bool improved = false;
+    if (refined.result.classification_error < best.result.classification_error ||
+        (refined.result.classification_error == best.result.classification_error && refined.feature < best.feature)) {
+        best = refined;
+    }
+    return best;
+}
 
-            ClassifierResult result = applyFeature(feat);
-            if (result.classification_error < best.classification_error) {
-                improved = true;
-                best = result;
+shdptr<classifiervec>
+Learner::train(int numWeakClassifiers) {
+    size_t run_classifiers = 0;
+
+    if (scores.size() != columns.size()) {
+        // Seed from the same responses the rounds below add to the scores: the matrix when there is one.
+        scores.assign(columns.size(), 0);
+        FeatureTable trained = compile(*weakClassifiers, *samples);
+        for (size_t k = 0; k < weakClassifiers->size(); ++k) {
+            const auto &c = (*weakClassifiers)[k];
+            const long f = featureIndex(*c.feat);
+            for (size_t i = 0; i < columns.size(); ++i) {
+                int h = f >= 0 ? classify(response((size_t) f, i), c.threshold, c.polarity)
+                               : runWeakClassifier(*samples, columns[i], c, trained, k);
+                scores[i] += c.alpha * h;
             }
+        }
+    }
 
-            if (improved || status == 0) {
-                auto end = std::chrono::high_resolution_clock::now();
-                auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-                auto total_duration = std::chrono::duration_cast<std::chrono::seconds>(
-                        end - total_start).count();
-                auto features_perc = 100.0 * (flt) i / (flt) features->size();
-                printf("\t[%lds]\t(%d/%d)\t| Stage: [%ldms] %.2f%% (%zu/%zu)",
-                       total_duration, t + 1, numWeakClassifiers, duration, features_perc, i + 1, features->size());
-                if (improved)
-                    printf(" \tError improved to %f\t%s", best.classification_error, best.feat->str().c_str());
+    auto total_start = std::chrono::high_resolution_clock::now();
+    size_t per_round = features->size();
+    for (int t = (int) weakClassifiers->size(); t < numWeakClassifiers; t++) {
+        auto start = std::chrono::high_resolution_clock::now();
 
-                auto remaining_time =
-                        ((flt) total_duration / (flt) run_classifiers) * ((flt) (TOTAL_CLASSIFIERS - run_classifiers));
-                printf(" \tRemaining time: %lds", (long) remaining_time);
+        normalizeWeights();
+        prepareRound();
+
+        RoundProgress progress{t, numWeakClassifiers, start, total_start, run_classifiers,
+                               run_classifiers + per_round * (numWeakClassifiers - t)};
+        size_t evaluated = 0;
+        FeatureChoice choice = searchRound(progress, evaluated);
+        auto round_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+        run_classifiers += evaluated;
+        per_round = evaluated;
+
+        if (sampling.compare && sampling.mode != SampleAll) {
+            vec<uint32_t> all(features->size());
+            std::iota(all.begin(), all.end(), 0);
+            auto exhaustive_start = std::chrono::high_resolution_clock::now();
+            FeatureChoice exhaustive = searchFeatures(all, nullptr, progress);
+            auto exhaustive_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::high_resolution_clock::now() - exhaustive_start).count();
+            printf("Round %d: %s search evaluated %zu/%zu features in %ldms, error %f; exhaustive %f in %ldms\n",
+                   t + 1, sampling.mode == SampleRandom ? "random" : "coarse to fine", evaluated, features->size(),
+                   round_ms, choice.result.classification_error, exhaustive.result.classification_error,
+                   exhaustive_ms);
+        }
 
-                std::cout << std::endl;
+        const ClassifierResult &best = choice.result;
+        const size_t best_i = choice.feature;
 
-                status = STATUS_EVERY;
-            }
-            ++i;
+        // The search saw only the active samples; alpha comes from the error on all of them. Same responses the
+        // threshold was picked from, so quantized matrices classify consistently.
+        vec<int> hypotheses(columns.size());
+        flt full_error = 0;
+        for (size_t i = 0; i < columns.size(); ++i) {
+            hypotheses[i] = classify(response(best_i, i), best.threshold, best.polarity);
+            full_error += weights[i] * std::abs(hypotheses[i] - labels[i]);
         }
-        auto beta = best.classification_error / (1.0 - best.classification_error);
+
+        // A separating feature has no error, which would give it an infinite alpha and zero every weight.
+        const flt MIN_ERROR = 1e-10;
+        auto error = std::max(full_error, MIN_ERROR);
+        auto beta = error / (1.0 - error);
         auto alpha = std::log(1.0 / beta);
 
         WeakClassifier classifier{best.threshold, best.polarity, (flt) alpha, best.feat};
 
-        for (i = 0; i < integrals.size(); ++i) {
-            auto im = integrals[i];
-            auto label = labels[i];
-            auto h = runWeakClassifier(*im, classifier);
-            auto e = std::abs(h - label);
+        for (size_t i = 0; i < columns.size(); ++i) {
+            auto e = std::abs(hypotheses[i] - labels[i]);
             weights[i] = weights[i] * std::pow(beta, 1 - e);
         }
 
+        flt alpha_sum = alpha;
+        for (const auto &c: *weakClassifiers) {
+            alpha_sum += c.alpha;
+        }
+        size_t wrong = 0;
+        for (size_t i = 0; i < columns.size(); ++i) {
+            scores[i] += alpha * hypotheses[i];
+            if ((scores[i] >= 0.5 * alpha_sum ? 1 : 0) != labels[i]) ++wrong;
+        }
+        printf("Round %d: searched %zu/%zu samples (%.1f%%), error %f on them, %f on all, training error %.2f%%\n",
+               t + 1, active.size(), columns.size(), 100.0 * (flt) active.size() / (flt) columns.size(),
+               best.classification_error, full_error, 100.0 * (flt) wrong / (flt) columns.size());
+
         weakClassifiers->push_back(classifier);
     }
     return weakClassifiers;
@@ -3,9 +3,14 @@
 #include <omp.h>
 #include <utility>
 #include <fstream>
+#include <unordered_map>
 
 #include "image.h"
 #include "feature.h"
+#include "feature_table.h"
+#include "responses.h"
+#include "sample_store.h"
+#include "parallel.h"
 #include "utils.h"
 
 typedef ImgFlt flt;
@@ -18,7 +23,13 @@ typedef struct {
     int polarity;
     flt alpha;
     const shdptr<Feature> feat;
+    // Soft cascade: a window whose weighted sum up to and including this classifier is below it can be rejected
+    // without evaluating the rest of the stage. -inf if not calibrated.
+    flt rejectThreshold = -std::numeric_limits<flt>::infinity();
 
+    /**
+     * @brief threshold,polarity,alpha,type,x,y,width,height,rejectThreshold
+     */
     [[nodiscard]] std::string csv() const;
 } WeakClassifier;
 
@@ -43,17 +54,39 @@ typedef struct {
     shdptr<Feature> feat;
 } ClassifierResult;
 
-typedef struct {
-    flt threshold;
-    int polarity;
-} ThresholdPolarity;
+/**
+ * @brief How a round searches the threshold of each feature.
+ *
+ * SearchExact sorts the samples by response for every feature in every round. SearchSorted walks a SortedIndex built
+ * once for the response matrix instead, so a round is a linear scan per feature. Neither changes the learner's state,
+ * so features are searched in parallel with every method.
+ * SearchBinned only considers thresholds at the edges of ResponseBins: a round adds each sample's weight to a histogram
+ * per feature and scans the bins, trading some threshold resolution for sequential byte reads.
+ */
+enum ThresholdSearch {
+    SearchExact,
+    SearchSorted,
+    SearchBinned
+};
+
+/**
+ * @brief Which features a round searches. SampleRandom searches a seeded random subset of them, SampleCoarseToFine
+ * a grid of every `step`'th position and size, then every feature around the best of those.
+ */
+enum FeatureSampling {
+    SampleAll,
+    SampleRandom,
+    SampleCoarseToFine
+};
 
 typedef struct {
-    flt t_minus;
-    flt t_plus;
-    fltvec s_minuses;
-    fltvec s_pluses;
-} RunningSums;
+    FeatureSampling mode;
+    flt fraction;       // SampleRandom: fraction of the features searched each round
+    uint32_t seed;      // SampleRandom: the subset of a round depends only on the seed and the round number
+    int step;           // SampleCoarseToFine: grid step in positions and in multiples of the feature's cell size
+    size_t candidates;  // SampleCoarseToFine: best grid features whose neighbourhood is searched
+    bool compare;       // also search all features each round and log both errors; costs a full search per round
+} SamplingOptions;
 
 typedef struct {
     flt alphaSum;
@@ -71,43 +104,186 @@ typedef struct {
 
 class Learner {
 private:
+    typedef struct {
+        ClassifierResult result;
+        size_t feature;
+    } FeatureChoice;
+
+    typedef struct {
+        int round;
+        int rounds;
+        std::chrono::high_resolution_clock::time_point start;
+        std::chrono::high_resolution_clock::time_point totalStart;
+        size_t evaluated;   // features evaluated by earlier rounds of this train() call
+        size_t total;       // expected number of evaluations of the whole call
+    } RoundProgress;
+
+    vec<uint32_t> coarse;   // features on the coarse grid of SampleCoarseToFine
+    std::unordered_map<uint64_t, uint32_t> geometry;    // (type, x, y, width, height) to feature index
 
 
     void initWeights();
 
     void normalizeWeights();
 
-    ClassifierResult applyFeature(shdptr<Feature> feature);
+    ClassifierResult applyFeature(size_t f) const;
+
+    ClassifierResult applyFeatureSorted(size_t f) const;
+
+    ClassifierResult applyFeatureBinned(size_t f, fltvec &histogram) const;
+
+    /**
+     * @brief Best threshold of feature f with the current `search`. `histogram` is scratch space for SearchBinned.
+     */
+    ClassifierResult searchFeature(size_t f, fltvec &histogram) const;
 
-    RunningSums buildRunningSums();
+    /**
+     * @brief Best of `candidates` (feature indices) on all pool workers, printing progress. Fills `errors[k]` with the
+     * error of candidates[k] if given.
+     */
+    FeatureChoice searchFeatures(const vec<uint32_t> &candidates, fltvec *errors, const RoundProgress &progress) const;
 
-    static int weakClassifier(const ImgType &img, shdptr<Feature> feat, flt threshold, int polarity);
+    [[nodiscard]] vec<uint32_t> roundCandidates(int round) const;
 
-    static int runWeakClassifier(const ImgType &img, const WeakClassifier &weakClassifier_);
+    void buildCoarseGrid();
 
-    static ThresholdPolarity
-    findBestThreshold(const fltvec &results, const RunningSums &runningSums);
+    /**
+     * @brief Index of the feature with the geometry of `feat`, or -1 if the learner has no such feature.
+     */
+    long featureIndex(const Feature &feat);
 
-    ThresholdPolarity determineThresholdPolarity(const fltvec &results);
+    /**
+     * @brief Features of the same type within one coarse step of any of `seeds` in position and size.
+     */
+    [[nodiscard]] vec<uint32_t> refineCandidates(const vec<uint32_t> &seeds) const;
+
+    FeatureChoice searchRound(const RoundProgress &progress, size_t &evaluated);
+
+    /**
+     * @brief Pick the round's `active` samples, their weight totals and, for SearchSorted, `columnWeights`.
+     */
+    void prepareRound();
+
+    [[nodiscard]] flt response(size_t f, size_t i) const {
+        if (responses) return responses->at(f, columns[i]);
+        return samples->response(table, f, columns[i]);
+    }
+
+    static int classify(flt response, flt threshold, int polarity) {
+        return (flt) polarity * response < (flt) polarity * threshold ? 1 : 0;
+    }
+
+    static int weakClassifier(ImgViewType img, shdptr<Feature> feat, flt threshold, int polarity);
+
+    /**
+     * @brief Best threshold and polarity from responses visited in ascending order.
+     *
+     * `value(k)` is the k'th smallest response and `weight(k)` the weight of its sample, positive for faces and
+     * negative for backgrounds. Samples with equal responses are always on the same side of a threshold, so errors are
+     * only compared at the end of each run of equal values. The returned error is exact for the returned threshold.
+     */
+    template<typename Value, typename Weight>
+    static ClassifierResult scanThresholds(size_t n, Value value, Weight weight, flt tPlus, flt tMinus) {
+        ClassifierResult best{0, 0, std::numeric_limits<flt>::max(), nullptr};
+        flt s_plus = 0, s_minus = 0;
+        size_t k = 0;
+        while (k < n) {
+            const flt v = value(k);
+
+            // polarity 1: everything below v is a face
+            flt err = s_minus + (tPlus - s_plus);
+            if (err < best.classification_error) best = {v, 1, err, nullptr};
+
+            for (; k < n && value(k) == v; ++k) {
+                flt w = weight(k);
+                if (w > 0) s_plus += w;
+                else s_minus -= w;
+            }
+
+            // polarity -1: everything above v is a face
+            err = s_plus + (tMinus - s_minus);
+            if (err < best.classification_error) best = {v, -1, err, nullptr};
+        }
+        return best;
+    }
 
 public:
-    std::vector<shdptr<ImgType>> integrals;
+    shdptr<SampleStore> samples;
+    vec<uint32_t> columns;  // index of each sample in `samples`, and so its column in `responses`
     std::vector<int> labels;
     fltvec weights;
     shdptr<std::vector<shdptr<Feature>>> features;
+    FeatureTable table;     // `features` compiled for the layout of `samples`
+    shdptr<ResponseMatrix> responses;
+    ThresholdSearch search = SearchExact;
+    shdptr<SortedIndex> sorted;
+    shdptr<ResponseBins> bins;
+    fltvec columnWeights;   // signed weight of every column of `responses` this round, 0 if not an active sample
+    flt trimFraction = 1.0;
+    vec<uint32_t> active;   // samples searched this round
+    flt totalPlus = 0;      // weight of the active faces
+    flt totalMinus = 0;     // weight of the active backgrounds
+    fltvec scores;          // sum of alpha * h of every sample over `weakClassifiers`
+    SamplingOptions sampling{SampleAll, 1.0, 0, 2, 32, false};
 
     shdptr<classifiervec> weakClassifiers;
     std::vector<fltvec> weightHist;
 
-    Learner(std::vector<shdptr<ImgType>> normalizedIntegrals,
+    /**
+     * @param store Normalized integrals.
+     * @param cols The samples to train on, as indices into `store`.
+     * @param lbls Label of each of them.
+     */
+    Learner(shdptr<SampleStore> store,
+            vec<uint32_t> cols,
             std::vector<int> lbls,
             shdptr<std::vector<shdptr<Feature>>> feats);
 
     ~Learner() = default;
 
-    void reInit(std::vector<shdptr<ImgType>> integrals, intvec lbls);
-
-    static StrongClassifierResult strongClassifier(const ImgType &img, const classifiervec &weakClassifiers);
+    /**
+     * @brief Read feature responses from a matrix precomputed on `samples` instead of evaluating them every round.
+     */
+    void useResponses(shdptr<ResponseMatrix> matrix);
+
+    /**
+     * @brief Search thresholds by scanning `index`, which must be built from the matrix given to useResponses().
+     */
+    void useSortedIndex(shdptr<SortedIndex> index);
+
+    /**
+     * @brief Search thresholds between the bins of `quantized`, built from the matrix given to useResponses().
+     */
+    void useBins(shdptr<ResponseBins> quantized);
+
+    /**
+     * @brief Search each round's features only on the heaviest samples that hold `fraction` of the weight. The chosen
+     * classifier is scored on all samples before its alpha is set. 1 searches all samples.
+     */
+    void useWeightTrimming(flt fraction);
+
+    void useFeatureSampling(const SamplingOptions &options);
+
+    static int runWeakClassifier(ImgViewType img, const WeakClassifier &weakClassifier_);
+
+    /**
+     * @brief runWeakClassifier() of sample i of `store`, whose feature is feature f of `table`.
+     */
+    static int runWeakClassifier(const SampleStore &store, size_t i, const WeakClassifier &weakClassifier_,
+                                 const FeatureTable &table, size_t f);
+
+    static StrongClassifierResult strongClassifier(ImgViewType img, const classifiervec &weakClassifiers);
+
+    /**
+     * @brief The features of `weakClassifiers`, in order, compiled for the samples of `store`.
+     */
+    static FeatureTable compile(const classifiervec &weakClassifiers, const SampleStore &store);
+
+    /**
+     * @brief strongClassifier() of sample i of `store`, with `table` = compile(weakClassifiers, store).
+     */
+    static StrongClassifierResult strongClassifier(const SampleStore &store, size_t i,
+                                                   const classifiervec &weakClassifiers, const FeatureTable &table);
 
     shdptr<classifiervec> train(int numWeakClassifiers);
 };
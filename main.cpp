@@ -8,12 +8,22 @@
 #include "learner.h"
 #include "cascade.h"
 #include "runtime.h"
+#include "model.h"
+#include "bench.h"
 
 int train_manual(int numClassifiers) {
     const int FACE_COUNT = 1000;
     const int BG_COUNT = 1000;
 
     const char *CLASSIFIER_DIR = "../classifiers/paper_impl";
+    const bool PRECOMPUTE_RESPONSES = true;
+    const ResponseFormat RESPONSE_FORMAT = ResponseFloat32;
+    const ThresholdSearch THRESHOLD_SEARCH = SearchSorted;  // needs PRECOMPUTE_RESPONSES
+    const uint32_t RESPONSE_BINS = 256;                     // for SearchBinned
+    const double WEIGHT_TRIMMING = 1.0;                     // weight fraction searched each round, e.g. 0.99
+    // {SampleRandom, 0.1, seed, ...} or {SampleCoarseToFine, ..., 2, 32, ...}; set compare to log exhaustive errors
+    const SamplingOptions FEATURE_SAMPLING = {SampleAll, 0.1, 1, 2, 32, false};
+    const SampleFormat SAMPLE_FORMAT = SampleFloat64;       // SampleFloat32 / SampleInt32 halve the sample store
 
     if (mkdir(CLASSIFIER_DIR, 0777) == -1) {
     } else {
@@ -23,21 +33,27 @@ int train_manual(int numClassifiers) {
     auto face_paths = list_dir(FP_FACES_DIR);
     auto bg_paths = list_dir(FP_BGS_DIR);
     auto samples = sample_data(FACE_COUNT, BG_COUNT, face_paths, bg_paths);
-    auto stats = compute_stats(samples.ims);
-    printf("mean: %f, std: %f\n", stats.mean, stats.std);
 
     auto features = generate_features();
     print_features(features);
     vec<shdptr<Feature>> fvec = feature_vec(features);
 
-    vec<shdptr<ImgType>> integrals;
-    for (auto &im: samples.ims) {
-        im.normalize(stats.mean, stats.std);
-        auto integral = im.toIntegral();
-        integrals.push_back(std::make_shared<ImgType>(integral));
+    auto store = SampleStore::create(CACHE_DIR, SAMPLE_FORMAT, samples.ims);
+    vec<uint32_t> columns(store->size());
+    std::iota(columns.begin(), columns.end(), 0);
+
+    Learner learner(store, columns, samples.labels, mkshd(fvec));
+    if (PRECOMPUTE_RESPONSES) {
+        auto matrix = ResponseMatrix::loadOrBuild(CACHE_DIR, learner.table, *store, RESPONSE_FORMAT);
+        learner.useResponses(matrix);
+        if (THRESHOLD_SEARCH == SearchSorted) {
+            learner.useSortedIndex(SortedIndex::loadOrBuild(CACHE_DIR, *matrix));
+        } else if (THRESHOLD_SEARCH == SearchBinned) {
+            learner.useBins(ResponseBins::loadOrBuild(CACHE_DIR, *matrix, RESPONSE_BINS));
+        }
     }
-
-    Learner learner(integrals, samples.labels, mkshd(fvec));
+    learner.useWeightTrimming(WEIGHT_TRIMMING);
+    learner.useFeatureSampling(FEATURE_SAMPLING);
     learner.train(numClassifiers);
 
     // save to file
@@ -48,12 +64,25 @@ int train_manual(int numClassifiers) {
     return 0;
 }
 
-int train_cascade() {
+/**
+ * @param resumeDir Cascade directory of an interrupted run to continue from its checkpoint, or empty for a new run.
+ */
+int train_cascade(const std::string &resumeDir) {
     const int FACE_COUNT = 2500;
     const int BG_COUNT = 2500;
     const double MAX_FALSE_POSITIVE = 0.005;
     const double MIN_DETECTION = 0.995;
     const double TARGET_OVERALL_FALSE_POSITIVE = 0.0025;
+    const bool PRECOMPUTE_RESPONSES = true;
+    const ResponseFormat RESPONSE_FORMAT = ResponseFloat32;
+    const ThresholdSearch THRESHOLD_SEARCH = SearchSorted;  // needs PRECOMPUTE_RESPONSES
+    const uint32_t RESPONSE_BINS = 256;                     // for SearchBinned
+    const double WEIGHT_TRIMMING = 1.0;                     // weight fraction searched each round, e.g. 0.99
+    // {SampleRandom, 0.1, seed, ...} or {SampleCoarseToFine, ..., 2, 32, ...}; set compare to log exhaustive errors
+    const SamplingOptions FEATURE_SAMPLING = {SampleAll, 0.1, 1, 2, 32, false};
+    const bool MINE_NEGATIVES = true;                       // refill the negatives from FP_BGS_DIR after each stage
+    const MiningOptions MINING = {SCALE_FACTOR, 4, 16};     // {scale factor, stride, max windows per image}
+    const SampleFormat SAMPLE_FORMAT = SampleFloat64;       // SampleFloat32 / SampleInt32 halve the sample stores
 
     const char *CLASSIFIER_DIR = "../classifiers/";
 
@@ -62,32 +91,47 @@ int train_cascade() {
             CLASSIFIER_DIR, FACE_COUNT, BG_COUNT, FEATURE_SIZE, MAX_FALSE_POSITIVE, MIN_DETECTION,
             TARGET_OVERALL_FALSE_POSITIVE
     );
-    if (mkdir(dir, 0777) == -1) {
-        printf("Cascade already exists!");
+    shdptr<Checkpoint> checkpoint;
+    uint32_t seed;
+    if (!resumeDir.empty()) {
+        snprintf(dir, sizeof dir, "%s", resumeDir.c_str());
+        checkpoint = mkshd<Checkpoint>(AttentionalCascade::loadCheckpoint(dir));
+        seed = checkpoint->seed;
+        printf("Resuming cascade in %s\n", dir);
+    } else if (mkdir(dir, 0777) == -1) {
+        printf("Cascade already exists! Continue it with --resume %s\n", dir);
         return 1;
     } else {
+        seed = std::random_device{}();
         printf("Created cascade directory: %s\n", dir);
     }
+    // The seed is kept in the checkpoint, so a resumed run samples exactly the same data.
+    seed_rng(seed);
 
     auto face_paths = list_dir(FP_FACES_DIR);
     auto bg_paths = list_dir(FP_BGS_DIR);
     auto samples = sample_data(FACE_COUNT, BG_COUNT, face_paths, bg_paths);
     auto validation = sample_data(FACE_COUNT, BG_COUNT, face_paths, bg_paths);
-    auto stats = compute_stats(samples.ims);
-    printf("mean: %f, std: %f\n", stats.mean, stats.std);
 
     auto features = generate_features();
     print_features(features);
 
-    auto cascade = AttentionalCascade(samples.ims, samples.labels, features, stats, validation);
-    auto cascade_classifiers = cascade.train(MAX_FALSE_POSITIVE, MIN_DETECTION, TARGET_OVERALL_FALSE_POSITIVE);
-
-    for (int i = 0; i < cascade_classifiers.size(); ++i) {
-        auto c = cascade_classifiers[i];
-        char path[300];
-        sprintf(path, "%s/%d.csv", dir, i);
-        save_weak_classifiers(path, *c);
+    auto cascade = AttentionalCascade(std::move(samples.ims), samples.labels, features, std::move(validation),
+                                      SAMPLE_FORMAT);
+    if (PRECOMPUTE_RESPONSES) {
+        cascade.precomputeResponses(RESPONSE_FORMAT, THRESHOLD_SEARCH, RESPONSE_BINS);
     }
+    cascade.useWeightTrimming(WEIGHT_TRIMMING);
+    cascade.useFeatureSampling(FEATURE_SAMPLING);
+    if (MINE_NEGATIVES) {
+        cascade.useNegativeMining(bg_paths, MINING);
+    }
+    // Stages are saved to `dir` as they complete.
+    cascade.useCheckpoints(dir, seed);
+    if (checkpoint) {
+        cascade.resumeFrom(*checkpoint);
+    }
+    cascade.train(MAX_FALSE_POSITIVE, MIN_DETECTION, TARGET_OVERALL_FALSE_POSITIVE);
 
     return 0;
 }
@@ -95,22 +139,13 @@ int train_cascade() {
 int test_image() {
     const char *CLASSIFIER_DIR = "../classifiers/paper_impl";
     const char *IMAGE_PATH = "../dataset/solvay-conference.jpg";
+    // {scale factor, stride at scale 1, window rows per task, soft cascade, ScanScaledFeatures / ScanPyramid}
+    const ScanOptions SCAN = {SCALE_FACTOR, 1.0, 4, true, ScanScaledFeatures};
 
-    vec<classifiervec> cascade;
-    {
-        std::vector<std::string> files;
-        for (const auto &entry: std::filesystem::directory_iterator(CLASSIFIER_DIR)) {
-            files.push_back(entry.path());
-        }
-        for (const auto &file: files) {
-            cascade.push_back(load_weak_classifiers(file));
-        }
-        std::sort(cascade.begin(), cascade.end(), [](const classifiervec &a, const classifiervec &b) {
-            return a.size() < b.size();
-        });
-    }
+    auto model = CascadeModel::openConverted(CLASSIFIER_DIR);
 
     ImgType integral(0, 0);
+    ImgType squared(0, 0);
     cv::Mat cvim;
     {
         cv::Mat tmp = cv::imread(IMAGE_PATH, cv::IMREAD_COLOR);
@@ -119,13 +154,16 @@ int test_image() {
 
         integral = ImgType(cvim.rows, cvim.cols);
         integral.loadGrayScale(cvim);
-//        integral.rangeTo(255.0);
-        integral.normalize();
-        integral = integral.toIntegral();
+        // No normalization here, the runtime normalizes each window from the squared integral.
+        integral = integral.toIntegral(squared);
     }
 
-    auto runtime = Runtime(cascade);
-    auto boxes = runtime.run(integral);
+    auto runtime = Runtime(*model, SCAN);
+    auto start = std::chrono::high_resolution_clock::now();
+    auto boxes = runtime.run(integral, squared);
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+    printf("Scanned %dx%d in %.1fms\n", cvim.cols, cvim.rows, (double) duration / 1000.0);
     Runtime::drawBoxes(cvim, boxes);
 
     cv::imshow("image", cvim);
@@ -137,10 +175,23 @@ int test_image() {
 enum Mode {
     TrainManual,
     TrainCascade,
-    TestImage
+    TestImage,
+    BenchIntegral,
+    BenchDetector,
+    BenchPyramid,
+    BenchThresholdSearch
 };
 
-int main() {
+int main(int argc, char **argv) {
+    if (argc == 3 && std::string(argv[1]) == "--resume") {
+        return train_cascade(argv[2]);
+    }
+    if ((argc == 4 || argc == 5) && std::string(argv[1]) == "--convert") {
+        // --convert <directory of stage CSVs> <model> [window size]
+        CascadeModel::convert(argv[2], argv[3], argc == 5 ? std::stoi(argv[4]) : FEATURE_SIZE);
+        return 0;
+    }
+
 //    intvec intervals = {26, 50,51, 52, 100};
 //    for (int interval: intervals) {
 //        printf("interval: %d\n", interval);
@@ -152,8 +203,16 @@ int main() {
         case TrainManual:
             return train_manual(0);
         case TrainCascade:
-            return train_cascade();
+            return train_cascade("");
         case TestImage:
             return test_image();
+        case BenchIntegral:
+            return bench_integral();
+        case BenchDetector:
+            return bench_detector();
+        case BenchPyramid:
+            return bench_pyramid();
+        case BenchThresholdSearch:
+            return bench_threshold_search();
     }
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "mapped_file.h"
+
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+void
+MappedFile::unmap() {
+    if (map) munmap(map, mapSize);
+    if (fd != -1) ::close(fd);
+    map = nullptr;
+    fd = -1;
+}
+
+shdptr<MappedFile>
+MappedFile::open(const std::string &path) {
+    shdptr<MappedFile> file(new MappedFile());
+    file->path = path;
+    file->fd = ::open(path.c_str(), O_RDONLY);
+    if (file->fd == -1) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    file->mapSize = (size_t) lseek(file->fd, 0, SEEK_END);
+    void *map = mmap(nullptr, file->mapSize, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + path);
+    }
+    file->map = static_cast<uchar *>(map);
+    return file;
+}
+
+shdptr<MappedFile>
+MappedFile::create(const std::string &path, size_t size) {
+    shdptr<MappedFile> file(new MappedFile());
+    file->path = path;
+    file->tmpPath = path + ".tmp";
+    file->mapSize = size;
+    file->fd = ::open(file->tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file->fd == -1 || ftruncate(file->fd, (off_t) size) != 0) {
+        throw std::runtime_error("Could not create " + file->tmpPath);
+    }
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + file->tmpPath);
+    }
+    file->map = static_cast<uchar *>(map);
+    return file;
+}
+
+void
+MappedFile::commit() {
+    msync(map, mapSize, MS_SYNC);
+    unmap();
+    std::filesystem::rename(tmpPath, path);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include "constants.h"
+
+/**
+ * @brief A file mapped into memory. Either opened read only, or created at a temporary path and renamed into place by
+ * commit() once fully written, so an interrupted writer never leaves a valid looking file behind.
+ */
+class MappedFile {
+private:
+    int fd = -1;
+    uchar *map = nullptr;
+    size_t mapSize = 0;
+    std::string tmpPath;
+
+    MappedFile() = default;
+
+    void unmap();
+
+public:
+    std::string path;
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    static shdptr<MappedFile> open(const std::string &path);
+
+    static shdptr<MappedFile> create(const std::string &path, size_t size);
+
+    /**
+     * @brief Flush a created file and move it to its final path. The mapping is released.
+     */
+    void commit();
+
+    [[nodiscard]] uchar *data() const { return map; }
+
+    [[nodiscard]] size_t size() const { return mapSize; }
+};
@@ -0,0 +1,124 @@
+#include "mining.h"
+
+#include <chrono>
+#include "parallel.h"
+#include "program.h"
+#include "runtime.h"
+
+NegativeMiner::NegativeMiner(paths backgrounds, MiningOptions options) : options(options) {
+    if (this->options.scaleFactor <= 1.0 || this->options.stride < 1 || this->options.maxPerImage == 0) {
+        throw std::runtime_error("Mining needs a scale factor above 1, a positive stride and maxPerImage");
+    }
+    frames = ImageStore::loadOrBuild(CACHE_DIR, backgrounds, StoreFrames);
+}
+
+vec<shdptr<ImgType>>
+NegativeMiner::scanImage(size_t image, const vec<classifiervec> &stages, const fltvec &thresholds,
+                         size_t &windows, size_t &found) const {
+    ImgType full = frames->image(image);
+    ImgType full_squared(0, 0);
+    ImgType full_integral = full.toIntegral(full_squared);
+
+    vec<ImgType> levels;
+    vec<Window> candidates;
+    windows = 0;
+    size_t evaluated = 0;
+    const int batch = CascadeProgram::batchSize();
+    // The levels of Runtime::buildPyramid(), so the windows are those a ScanPyramid scan with this stride sees.
+    for (flt scale = 1.0;; scale *= options.scaleFactor) {
+        int h = (int) ((flt) full.height / scale);
+        int w = (int) ((flt) full.width / scale);
+        if (h < FEATURE_SIZE || w < FEATURE_SIZE) break;
+        ImgType squared = full_squared;
+        ImgType integral = full_integral;
+        if (levels.empty()) {
+            levels.push_back(full);
+        } else {
+            levels.emplace_back(h, w);
+            downscale(full_integral, scale, levels.back().view());
+            integral = levels.back().toIntegral(squared);
+        }
+        const int level = (int) levels.size() - 1;
+        // Decide like the Runtime: the cascade compiled for this level, each window normalized on the fly.
+        CascadeProgram program(stages, thresholds, FEATURE_SIZE, 1.0, options.stride, integral.stride);
+
+        for (int y = 0; y + FEATURE_SIZE <= h; y += options.stride) {
+            int x = 0;
+            for (; batch > 1 && x + (batch - 1) * options.stride + FEATURE_SIZE <= w; x += batch * options.stride) {
+                windows += batch;
+                uint32_t accepted = program.runBatch(integral.row(y) + x, squared.row(y) + x, false, evaluated);
+                for (int i = 0; i < batch; ++i) {
+                    if (accepted >> i & 1) candidates.push_back({level, x + i * options.stride, y});
+                }
+            }
+            for (; x + FEATURE_SIZE <= w; x += options.stride) {
+                windows++;
+                const ImgFlt *window = integral.row(y) + x;
+                if (program.run(window, program.windowStats(window, squared.row(y) + x), false, evaluated)) {
+                    candidates.push_back({level, x, y});
+                }
+            }
+        }
+    }
+
+    // Store the false positives like the training samples. The learner sees the same normalized window, so up to
+    // rounding it scores them as the program did.
+    vec<shdptr<ImgType>> hits;
+    for (const auto &c: candidates) {
+        const ImgType &src = levels[c.level];
+        ImgType window(FEATURE_SIZE, FEATURE_SIZE);
+        for (int y = 0; y < FEATURE_SIZE; ++y) {
+            for (int x = 0; x < FEATURE_SIZE; ++x) {
+                window[y][x] = src[c.y + y][c.x + x];
+            }
+        }
+        window.rangeTo(255.0);
+        window.normalize(SAMPLE_MIN_STD);
+        hits.push_back(mkshd<ImgType>(window.toIntegral()));
+    }
+    found = hits.size();
+
+    if (hits.size() <= options.maxPerImage) return hits;
+    vec<shdptr<ImgType>> kept;
+    kept.reserve(options.maxPerImage);
+    for (size_t j = 0; j < options.maxPerImage; ++j) {
+        kept.push_back(hits[j * hits.size() / options.maxPerImage]);
+    }
+    return kept;
+}
+
+vec<shdptr<ImgType>>
+NegativeMiner::mine(const vec<classifiervec> &stages, const fltvec &thresholds, size_t count, MiningReport &report) {
+    auto start = std::chrono::high_resolution_clock::now();
+    report = {};
+    vec<shdptr<ImgType>> mined;
+    ThreadPool &pool = ThreadPool::shared();
+
+    while (mined.size() < count && !exhausted()) {
+        const size_t first = cursor;
+        const size_t batch = std::min(pool.size(), frames->size() - first);
+        vec<vec<shdptr<ImgType>>> hits(batch);
+        vec<size_t> windows(batch);
+        vec<size_t> found(batch);
+        pool.parallelFor(batch, 1, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                hits[i] = scanImage(first + i, stages, thresholds, windows[i], found[i]);
+            }
+        });
+
+        // Take the images in order, so what is mined does not depend on the number of threads. Images after the one
+        // that filled the pool stay unscanned for the next call.
+        for (size_t i = 0; i < batch && mined.size() < count; ++i) {
+            cursor = first + i + 1;
+            report.images++;
+            report.windows += windows[i];
+            report.found += found[i];
+            size_t take = std::min(hits[i].size(), count - mined.size());
+            mined.insert(mined.end(), hits[i].begin(), hits[i].begin() + (long) take);
+        }
+    }
+
+    report.kept = mined.size();
+    report.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return mined;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "feature_table.h"
+#include "image_store.h"
+#include "learner.h"
+#include "utils.h"
+
+typedef struct {
+    flt scaleFactor;        // size ratio between neighbouring pyramid levels
+    int stride;             // window step in pixels on every level
+    size_t maxPerImage;     // false positives kept per image, spread over all that were found
+} MiningOptions;
+
+typedef struct {
+    size_t images;
+    size_t windows;
+    size_t found;           // false positives found, before maxPerImage
+    size_t kept;
+    double seconds;
+} MiningReport;
+
+/**
+ * @brief Collects hard negatives: windows of full background images that a partial cascade still accepts.
+ *
+ * Every image is scanned at its frame size (see StoreFrames) and on a pyramid of downscaled copies, so a window of
+ * FEATURE_SIZE pixels on a level covers a FEATURE_SIZE * scale region of the frame, as a random crop resized to
+ * FEATURE_SIZE does in sample_data. Windows are evaluated in place with the CascadeProgram of the level. The levels
+ * are those of the Runtime's ScanPyramid mode, so the negatives are exactly its false positives at the mining stride;
+ * for the default ScanScaledFeatures mode, which scales the features instead of the frame, they are an approximation
+ * (see ScanMode). Only the windows the cascade accepts are copied out and normalized like the training samples. Images
+ * are scanned in parallel, each at most once over the whole training.
+ */
+class NegativeMiner {
+private:
+    shdptr<ImageStore> frames;
+    MiningOptions options;
+
+    typedef struct {
+        int level;
+        int x;
+        int y;
+    } Window;
+
+    /**
+     * @brief Normalized integrals of the false positives of one image, in scan order.
+     */
+    vec<shdptr<ImgType>> scanImage(size_t image, const vec<classifiervec> &stages, const fltvec &thresholds,
+                                   size_t &windows, size_t &found) const;
+
+public:
+    size_t cursor = 0;      // next image to scan
+
+    NegativeMiner(paths backgrounds, MiningOptions options);
+
+    /**
+     * @brief Scan the next images until `count` false positives of the cascade are found or every image was scanned.
+     * @param thresholds Stage k accepts a window if its score is at least thresholds[k] times the sum of its alphas.
+     */
+    vec<shdptr<ImgType>> mine(const vec<classifiervec> &stages, const fltvec &thresholds, size_t count,
+                              MiningReport &report);
+
+    [[nodiscard]] bool exhausted() const { return cursor >= frames->size(); }
+};
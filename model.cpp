@@ -0,0 +1,203 @@
+#include "model.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "cascade.h"
+
+#define MODEL_VERSION 1
+
+static_assert(sizeof(ModelHeader) == 24, "ModelHeader layout");
+static_assert(sizeof(ModelStage) == 24, "ModelStage layout");
+static_assert(sizeof(ModelClassifier) == 48, "ModelClassifier layout");
+
+static size_t
+file_size(const ModelHeader &header) {
+    return sizeof(ModelHeader) + header.stages * sizeof(ModelStage) + header.classifiers * sizeof(ModelClassifier);
+}
+
+CascadeModel::CascadeModel(const std::string &path) {
+    this->path = path;
+    file = MappedFile::open(path);
+    header = reinterpret_cast<const ModelHeader *>(file->data());
+    if (file->size() < sizeof(ModelHeader) || std::memcmp(header->magic, "ODCM", 4) != 0 ||
+        header->version != MODEL_VERSION || header->stages > file->size() / sizeof(ModelStage) ||
+        header->classifiers > file->size() / sizeof(ModelClassifier) || file_size(*header) != file->size()) {
+        throw std::runtime_error("Not a valid cascade model: " + path);
+    }
+    stageTable = reinterpret_cast<const ModelStage *>(file->data() + sizeof(ModelHeader));
+    classifierTable = reinterpret_cast<const ModelClassifier *>(stageTable + header->stages);
+
+    // Stages are read straight from the mapping, so their ranges must tile the classifier table in order.
+    uint64_t first = 0;
+    for (uint32_t s = 0; s < header->stages; ++s) {
+        if (stageTable[s].first != first || stageTable[s].count > header->classifiers - first) {
+            throw std::runtime_error("Not a valid cascade model: " + path);
+        }
+        first += stageTable[s].count;
+    }
+    if (first != header->classifiers) {
+        throw std::runtime_error("Not a valid cascade model: " + path);
+    }
+    for (uint64_t k = 0; k < header->classifiers; ++k) {
+        if (classifierTable[k].type > FeatType4) {
+            throw std::runtime_error("Not a valid cascade model: " + path);
+        }
+    }
+}
+
+shdptr<CascadeModel>
+CascadeModel::open(const std::string &path) {
+    return shdptr<CascadeModel>(new CascadeModel(path));
+}
+
+void
+CascadeModel::save(const std::string &path, const vec<classifiervec> &stages, const fltvec &thresholds,
+                   int windowSize) {
+    if (thresholds.size() != stages.size()) {
+        throw std::runtime_error("Every stage of a model needs a threshold");
+    }
+    ModelHeader header{};
+    std::memcpy(header.magic, "ODCM", 4);
+    header.version = MODEL_VERSION;
+    header.windowSize = windowSize;
+    header.stages = stages.size();
+    for (const auto &stage: stages) {
+        header.classifiers += stage.size();
+    }
+
+    auto out = MappedFile::create(path, file_size(header));
+    std::memcpy(out->data(), &header, sizeof header);
+    auto *stage_out = reinterpret_cast<ModelStage *>(out->data() + sizeof(ModelHeader));
+    auto *classifier_out = reinterpret_cast<ModelClassifier *>(stage_out + header.stages);
+    uint32_t first = 0;
+    for (size_t s = 0; s < stages.size(); ++s) {
+        ModelStage stage{first, (uint32_t) stages[s].size(), thresholds[s], 0};
+        for (const auto &c: stages[s]) {
+            const Feature &f = *c.feat;
+            if (f.x + f.width > (size_t) windowSize || f.y + f.height > (size_t) windowSize) {
+                throw std::runtime_error("Feature outside of the model window: " + f.str());
+            }
+            ModelClassifier record{};
+            record.threshold = c.threshold;
+            record.alpha = c.alpha;
+            record.rejectThreshold = c.rejectThreshold;
+            record.polarity = c.polarity;
+            record.type = f.type();
+            record.x = f.x;
+            record.y = f.y;
+            record.width = f.width;
+            record.height = f.height;
+            classifier_out[first++] = record;
+            stage.alphaSum += c.alpha;
+        }
+        stage_out[s] = stage;
+    }
+    out->commit();
+}
+
+void
+CascadeModel::convert(const std::string &csvDir, const std::string &path, int windowSize) {
+    vec<std::pair<int, std::string>> files;
+    for (const auto &entry: std::filesystem::directory_iterator(csvDir)) {
+        if (entry.path().extension() != ".csv") continue;
+        files.emplace_back(std::stoi(entry.path().stem().string()), entry.path().string());
+    }
+    std::sort(files.begin(), files.end());
+
+    shdptr<Checkpoint> checkpoint;
+    if (std::filesystem::exists(std::filesystem::path(csvDir) / "checkpoint.txt")) {
+        checkpoint = mkshd<Checkpoint>(AttentionalCascade::loadCheckpoint(csvDir));
+    }
+
+    vec<classifiervec> stages;
+    fltvec thresholds;
+    for (const auto &[number, file]: files) {
+        classifiervec stage = load_weak_classifiers(file);
+        if (stage.empty()) throw std::runtime_error("Empty stage: " + file);
+        size_t k = stages.size();
+        flt alpha_sum = 0;
+        for (const auto &c: stage) {
+            alpha_sum += c.alpha;
+        }
+        flt threshold = 0.5;
+        if (checkpoint && k < checkpoint->completed) {
+            // thresholds[0] belongs to no stage.
+            threshold = checkpoint->thresholds[k + 1];
+        } else if (stage.back().rejectThreshold > -std::numeric_limits<flt>::infinity()) {
+            threshold = stage.back().rejectThreshold / alpha_sum;
+        }
+        printf("Stage %zu: %s, %zu weak classifiers, threshold %f\n", k, file.c_str(), stage.size(), threshold);
+        stages.push_back(std::move(stage));
+        thresholds.push_back(threshold);
+    }
+    save(path, stages, thresholds, windowSize);
+}
+
+shdptr<CascadeModel>
+CascadeModel::openConverted(const std::string &csvDir, int windowSize) {
+    // The stages and the checkpoint that convert() reads, in a fixed order.
+    vec<std::filesystem::path> files;
+    for (const auto &entry: std::filesystem::directory_iterator(csvDir)) {
+        if (entry.path().extension() == ".csv" || entry.path().filename() == "checkpoint.txt") {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    uint32_t params[] = {MODEL_VERSION, (uint32_t) windowSize};
+    uint64_t key = fnv1a(params, sizeof params);
+    for (const auto &file: files) {
+        std::string name = file.filename().string();
+        std::stringstream contents;
+        contents << std::ifstream(file).rdbuf();
+        std::string data = contents.str();
+        key = fnv1a(name.data(), name.size() + 1, key);
+        key = fnv1a(data.data(), data.size(), key);
+    }
+
+    std::filesystem::create_directories(CACHE_DIR);
+    char name[64];
+    snprintf(name, sizeof name, "model_%016llx.bin", (unsigned long long) key);
+    std::string path = (std::filesystem::path(CACHE_DIR) / name).string();
+    if (!std::filesystem::exists(path)) {
+        printf("Converting %s to %s\n", csvDir.c_str(), path.c_str());
+        convert(csvDir, path, windowSize);
+    }
+    return open(path);
+}
+
+classifiervec
+CascadeModel::weakClassifiers(size_t stage) const {
+    const ModelStage &s = stageTable[stage];
+    classifiervec classifiers;
+    classifiers.reserve(s.count);
+    for (size_t k = s.first; k < s.first + s.count; ++k) {
+        const ModelClassifier &c = classifierTable[k];
+        classifiers.push_back({c.threshold, c.polarity, c.alpha,
+                               make_feature((FeatureType) c.type, c.x, c.y, c.width, c.height), c.rejectThreshold});
+    }
+    return classifiers;
+}
+
+vec<classifiervec>
+CascadeModel::cascade() const {
+    vec<classifiervec> stages;
+    stages.reserve(this->stages());
+    for (size_t s = 0; s < this->stages(); ++s) {
+        stages.push_back(weakClassifiers(s));
+    }
+    return stages;
+}
+
+fltvec
+CascadeModel::thresholds() const {
+    fltvec values;
+    values.reserve(stages());
+    for (size_t s = 0; s < stages(); ++s) {
+        values.push_back(stageTable[s].threshold);
+    }
+    return values;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include "learner.h"
+#include "mapped_file.h"
+
+#define MODEL_FILE "cascade.bin"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t windowSize;    // side of the square window the cascade was trained on
+    uint32_t stages;
+    uint64_t classifiers;
+} ModelHeader;
+
+typedef struct {
+    uint32_t first;         // index of the stage's first classifier
+    uint32_t count;
+    double threshold;       // the stage accepts a window whose weighted sum is at least threshold * alphaSum
+    double alphaSum;
+} ModelStage;
+
+typedef struct {
+    double threshold;
+    double alpha;
+    double rejectThreshold;
+    int32_t polarity;
+    uint8_t type;           // FeatureType
+    uint8_t reserved[3];
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} ModelClassifier;
+
+/**
+ * @brief A trained cascade in one binary file: the header, the stages in order, then the weak classifiers of all
+ * stages in order. Every record has a fixed size and native layout, so the file is memory mapped and read in place;
+ * opening it only checks the header and the size.
+ */
+class CascadeModel {
+private:
+    shdptr<MappedFile> file;
+    const ModelHeader *header = nullptr;
+    const ModelStage *stageTable = nullptr;
+    const ModelClassifier *classifierTable = nullptr;
+
+    explicit CascadeModel(const std::string &path);
+
+public:
+    std::string path;
+
+    /**
+     * @brief Map the model at `path`. Throws unless its header, size and stage table match and every classifier has a
+     * known feature type, so nothing read from the mapping later can point outside it.
+     */
+    static shdptr<CascadeModel> open(const std::string &path);
+
+    /**
+     * @param thresholds Threshold of every stage, as tuned by AttentionalCascade::train.
+     */
+    static void save(const std::string &path, const vec<classifiervec> &stages, const fltvec &thresholds,
+                     int windowSize = FEATURE_SIZE);
+
+    /**
+     * @brief Write the model of a directory of stage CSV files, in the numeric order of their names. Stage thresholds
+     * come from the directory's checkpoint if it has one, else from the end of the stage's rejection trace, else the
+     * runtime's default of 0.5.
+     */
+    static void convert(const std::string &csvDir, const std::string &path, int windowSize = FEATURE_SIZE);
+
+    /**
+     * @brief The model of a directory of stage CSV files (see convert()), converted on first use into CACHE_DIR and
+     * keyed by the contents of the directory, so the directory itself is never written to.
+     */
+    static shdptr<CascadeModel> openConverted(const std::string &csvDir, int windowSize = FEATURE_SIZE);
+
+    [[nodiscard]] int windowSize() const { return (int) header->windowSize; }
+
+    [[nodiscard]] size_t stages() const { return header->stages; }
+
+    [[nodiscard]] const ModelStage &stage(size_t i) const { return stageTable[i]; }
+
+    [[nodiscard]] const ModelClassifier &classifier(size_t k) const { return classifierTable[k]; }
+
+    [[nodiscard]] classifiervec weakClassifiers(size_t stage) const;
+
+    [[nodiscard]] vec<classifiervec> cascade() const;
+
+    [[nodiscard]] fltvec thresholds() const;
+};
@@ -0,0 +1,84 @@
+#include "parallel.h"
+
+static thread_local bool IN_POOL_WORKER = false;
+
+bool
+in_pool_worker() {
+    return IN_POOL_WORKER;
+}
+
+ThreadPool::ThreadPool(size_t workers) {
+    if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+    threads.reserve(workers - 1);
+    for (size_t w = 1; w < workers; ++w) {
+        threads.emplace_back(&ThreadPool::work, this, w);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+ThreadPool &
+ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void
+ThreadPool::work(size_t worker) {
+    size_t seen = 0;
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || (generation != seen && worker < jobWorkers); });
+        if (stopping) return;
+        seen = generation;
+        lock.unlock();
+
+        IN_POOL_WORKER = true;
+        try {
+            job(worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (!error) error = std::current_exception();
+        }
+        IN_POOL_WORKER = false;
+
+        lock.lock();
+        if (--running == 0) done.notify_all();
+    }
+}
+
+void
+ThreadPool::run(const std::function<void(size_t)> &fn, size_t workers) {
+    std::lock_guard<std::mutex> serial(runMutex);
+    std::unique_lock<std::mutex> lock(mutex);
+    job = fn;
+    jobWorkers = workers;
+    running = workers - 1;
+    error = nullptr;
+    ++generation;
+    lock.unlock();
+    wake.notify_all();
+
+    IN_POOL_WORKER = true;
+    try {
+        fn(0);
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!error) error = std::current_exception();
+    }
+    IN_POOL_WORKER = false;
+
+    lock.lock();
+    done.wait(lock, [&]() { return running == 0; });
+    jobWorkers = 0;
+    if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "constants.h"
+
+/**
+ * @brief Fixed set of worker threads that run parallel loops. The calling thread takes part as worker 0.
+ */
+class ThreadPool {
+private:
+    vec<std::thread> threads;
+    std::mutex runMutex;    // one job at a time
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(size_t)> job;
+    size_t jobWorkers = 0;
+    size_t generation = 0;
+    size_t running = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void work(size_t worker);
+
+    /**
+     * @brief Run `fn(worker)` on workers 0 .. workers - 1 and wait for all of them. Rethrows the first exception.
+     */
+    void run(const std::function<void(size_t)> &fn, size_t workers);
+
+public:
+    /**
+     * @param workers Number of workers including the calling thread, 0 for one per hardware thread.
+     */
+    explicit ThreadPool(size_t workers = 0);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    [[nodiscard]] size_t size() const { return threads.size() + 1; }
+
+    /**
+     * @brief The pool shared by the whole program.
+     */
+    static ThreadPool &shared();
+
+    /**
+     * @brief Call `fn(worker, begin, end)` on chunks of `chunk` indices covering [0, n).
+     *
+     * Every worker starts on its own contiguous share of the chunks and, once that is done, takes the remaining chunks
+     * of the others, so uneven chunks do not leave threads idle. Chunks of one worker are not necessarily visited in
+     * order. `worker` is below min(size(), maxWorkers) and can index per worker state. A call from inside a pool
+     * worker runs serially on that worker.
+     */
+    template<typename F>
+    void parallelFor(size_t n, size_t chunk, F fn, size_t maxWorkers = 0);
+};
+
+/**
+ * @brief True on the threads of any ThreadPool while they run a job.
+ */
+bool
+in_pool_worker();
+
+template<typename F>
+void
+ThreadPool::parallelFor(size_t n, size_t chunk, F fn, size_t maxWorkers) {
+    if (n == 0) return;
+    chunk = std::max<size_t>(chunk, 1);
+    const size_t chunks = (n + chunk - 1) / chunk;
+    size_t workers = std::min(size(), chunks);
+    if (maxWorkers) workers = std::min(workers, maxWorkers);
+    if (workers <= 1 || in_pool_worker()) {
+        fn(0, 0, n);
+        return;
+    }
+
+    struct alignas(64) Range {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+    std::unique_ptr<Range[]> ranges(new Range[workers]);
+    for (size_t w = 0; w < workers; ++w) {
+        ranges[w].next = chunks * w / workers;
+        ranges[w].end = chunks * (w + 1) / workers;
+    }
+
+    run([&](size_t worker) {
+        for (size_t k = 0; k < workers; ++k) {
+            Range &range = ranges[(worker + k) % workers];
+            for (size_t c = range.next.fetch_add(1); c < range.end; c = range.next.fetch_add(1)) {
+                fn(worker, c * chunk, std::min(n, (c + 1) * chunk));
+            }
+        }
+    }, workers);
+}
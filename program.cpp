@@ -0,0 +1,204 @@
+#include "program_impl.h"
+
+namespace {
+
+ProgramIsa
+detect_isa() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return ProgramAvx512;
+    if (__builtin_cpu_supports("avx2")) return ProgramAvx2;
+#endif
+    return ProgramScalar;
+}
+
+const ProgramIsa SUPPORTED_ISA = detect_isa();
+ProgramIsa selected_isa = SUPPORTED_ISA;
+
+}
+
+ProgramIsa
+program_isa() {
+    return selected_isa;
+}
+
+void
+set_program_isa(ProgramIsa isa) {
+    selected_isa = isa <= SUPPORTED_ISA ? isa : SUPPORTED_ISA;
+}
+
+const char *
+program_isa_name(ProgramIsa isa) {
+    switch (isa) {
+        case ProgramScalar:
+            return "scalar";
+        case ProgramAvx2:
+            return "avx2";
+        case ProgramAvx512:
+            return "avx512";
+    }
+    return "unknown";
+}
+
+static_assert(sizeof(Instruction) == IMG_ALIGNMENT, "an instruction is one cache line");
+static_assert(HaarKernel<FeatType4>::N <= PROGRAM_MAX_CORNERS, "PROGRAM_MAX_CORNERS is too small");
+
+int
+scaleUp(int val, flt factor) {
+    return (int) ((flt) val * factor);
+}
+
+template<FeatureType Type>
+static void
+compile_offsets(const Feature &feat, size_t stride, Instruction &ins) {
+    HaarKernel<Type>::offsets(feat.x, feat.y, feat.width, feat.height, stride, ins.offsets);
+}
+
+CascadeProgram::CascadeProgram(const vec<classifiervec> &cascade, const fltvec &thresholds, int trainedSize, flt scale,
+                               int step, size_t stride) : windowSize(scaleUp(trainedSize, scale)), step(step),
+                                                          stride(stride) {
+    if (thresholds.size() != cascade.size()) {
+        throw std::runtime_error("Every stage of the cascade needs a threshold");
+    }
+    size_t total = 0;
+    for (const auto &stage: cascade) {
+        total += stage.size();
+    }
+    code.reserve(total);
+    rejectThresholds.reserve(total);
+    stages.reserve(cascade.size());
+
+    for (size_t s = 0; s < cascade.size(); ++s) {
+        if (cascade[s].empty()) throw std::runtime_error("Empty stage " + std::to_string(s));
+        ProgramStage stage{(uint32_t) code.size(), (uint32_t) cascade[s].size(), thresholds[s], 0,
+                           cascade[s].back().rejectThreshold > -std::numeric_limits<flt>::infinity()};
+        for (const auto &c: cascade[s]) {
+            const Feature &trained = *c.feat;
+            auto f = make_feature(trained.type(), scaleUp(trained.x, scale), scaleUp(trained.y, scale),
+                                  scaleUp(trained.width, scale), scaleUp(trained.height, scale));
+            if (f->x + f->width > (size_t) windowSize || f->y + f->height > (size_t) windowSize) {
+                throw std::runtime_error("Feature out of bounds of the scaled window: " + f->str());
+            }
+
+            Instruction &ins = code.emplace_back();
+            ins = {};
+            ins.type = f->type();
+            ins.polarity = (int8_t) c.polarity;
+            // Normalizing the window maps a response r to (r - mean * flat) / (std * areaScale), so the inverse is
+            // applied to the threshold instead of touching any pixels; areaScale is folded in here.
+            flt area_scale = (flt) (f->width * f->height) / (flt) (trained.width * trained.height);
+            ins.threshold = c.threshold * area_scale;
+            ins.flatResponse = f->flatResponse();
+            ins.alpha = c.alpha;
+            switch (f->type()) {
+                case FeatType2h:
+                    compile_offsets<FeatType2h>(*f, stride, ins);
+                    break;
+                case FeatType2v:
+                    compile_offsets<FeatType2v>(*f, stride, ins);
+                    break;
+                case FeatType3h:
+                    compile_offsets<FeatType3h>(*f, stride, ins);
+                    break;
+                case FeatType3v:
+                    compile_offsets<FeatType3v>(*f, stride, ins);
+                    break;
+                case FeatType4:
+                    compile_offsets<FeatType4>(*f, stride, ins);
+                    break;
+            }
+            rejectThresholds.push_back(c.rejectThreshold);
+            stage.alphaSum += c.alpha;
+        }
+        stages.push_back(stage);
+    }
+}
+
+Stats
+CascadeProgram::windowStats(const ImgFlt *window, const ImgFlt *squared) const {
+    const size_t right = windowSize;
+    const size_t bottom = windowSize * stride;
+    flt n = (flt) (windowSize * windowSize);
+    flt sum = window[bottom + right] - window[right] - window[bottom] + window[0];
+    flt sum_sq = squared[bottom + right] - squared[right] - squared[bottom] + squared[0];
+    flt mean = sum / n;
+    flt var = sum_sq / n - mean * mean;
+    flt std = var > 0 ? std::sqrt(var) : 0;
+    // Flat windows would blow up the normalization, treat them as having unit deviation.
+    return {mean, std < 1.0 ? 1.0 : std};
+}
+
+static inline ImgFlt
+response(const Instruction &ins, const ImgFlt *window) {
+    switch (ins.type) {
+        case FeatType2h:
+            return HaarKernel<FeatType2h>::evaluate(window, ins.offsets);
+        case FeatType2v:
+            return HaarKernel<FeatType2v>::evaluate(window, ins.offsets);
+        case FeatType3h:
+            return HaarKernel<FeatType3h>::evaluate(window, ins.offsets);
+        case FeatType3v:
+            return HaarKernel<FeatType3v>::evaluate(window, ins.offsets);
+        case FeatType4:
+            return HaarKernel<FeatType4>::evaluate(window, ins.offsets);
+    }
+    return 0;
+}
+
+static inline bool
+hypothesis(const Instruction &ins, const ImgFlt *window, Stats stats) {
+    flt threshold = ins.threshold * stats.std + stats.mean * ins.flatResponse;
+    return (flt) ins.polarity * response(ins, window) < (flt) ins.polarity * threshold;
+}
+
+bool
+CascadeProgram::run(const ImgFlt *window, Stats stats, bool softCascade, size_t &evaluated) const {
+    const Instruction *ins = code.data();
+    for (const auto &stage: stages) {
+        const size_t end = stage.first + stage.count;
+        flt sum = 0;
+        if (!softCascade) {
+            for (size_t k = stage.first; k < end; ++k) {
+                if (hypothesis(ins[k], window, stats)) sum += ins[k].alpha;
+            }
+            evaluated += stage.count;
+            if (!(sum >= stage.alphaSum * stage.threshold)) return false;
+            continue;
+        }
+
+        for (size_t k = stage.first; k < end; ++k) {
+            if (hypothesis(ins[k], window, stats)) sum += ins[k].alpha;
+            evaluated++;
+            if (sum < rejectThresholds[k]) return false;
+        }
+        // Stages without a trace decide like hard ones.
+        if (!stage.calibrated && !(sum >= stage.alphaSum * stage.threshold)) return false;
+    }
+    return true;
+}
+
+int
+CascadeProgram::batchSize() {
+    switch (selected_isa) {
+        case ProgramAvx512:
+            return 16;
+        case ProgramAvx2:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+uint32_t
+CascadeProgram::runBatch(const ImgFlt *window, const ImgFlt *squared, bool softCascade, size_t &evaluated) const {
+    switch (selected_isa) {
+#if defined(__x86_64__)
+        case ProgramAvx512:
+            return program_run_avx512(*this, window, squared, softCascade, evaluated);
+        case ProgramAvx2:
+            return program_run_avx2(*this, window, squared, softCascade, evaluated);
+#endif
+        default:
+            return run(window, windowStats(window, squared), softCascade, evaluated) ? 1 : 0;
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "feature_table.h"
+#include "learner.h"
+
+#define PROGRAM_MAX_CORNERS 9
+#define PROGRAM_MAX_BATCH 16
+
+typedef struct {
+    double mean;
+    double std;
+} Stats;
+
+enum ProgramIsa {
+    ProgramScalar,
+    ProgramAvx2,
+    ProgramAvx512
+};
+
+/**
+ * @brief Kernel used by CascadeProgram::runBatch(). Picked from the CPU on first use.
+ */
+ProgramIsa program_isa();
+
+/**
+ * @brief Force a kernel, e.g. for benchmarking. Falls back to the best supported one if `isa` is not available.
+ */
+void set_program_isa(ProgramIsa isa);
+
+const char *program_isa_name(ProgramIsa isa);
+
+/**
+ * @brief `val` pixels at a window scale of `factor`, rounded down.
+ */
+int scaleUp(int val, flt factor);
+
+/**
+ * @brief One weak classifier of a compiled cascade, sized and aligned to a cache line.
+ */
+typedef struct alignas(IMG_ALIGNMENT) {
+    int32_t offsets[PROGRAM_MAX_CORNERS];   // HaarKernel<type>::N corners, as offsets from the window origin
+    uint8_t type;                           // FeatureType
+    int8_t polarity;
+    double threshold;       // trained threshold times the area of the scaled feature over its trained area
+    double flatResponse;    // response of the scaled feature on a window of ones
+    double alpha;
+} Instruction;
+
+typedef struct {
+    uint32_t first;         // index of the stage's first instruction
+    uint32_t count;
+    flt threshold;          // the stage accepts a window whose weighted sum is at least threshold * alphaSum
+    flt alphaSum;
+    bool calibrated;        // the stage has a rejection trace, which ends at its threshold
+} ProgramStage;
+
+/**
+ * @brief A cascade scaled to one window size and compiled for one integral image layout.
+ *
+ * All weak classifiers of all stages are one contiguous, cache line aligned array of instructions, with the corner
+ * offsets of every feature resolved for the integral's stride. run() walks it stage by stage; the only other memory
+ * it reads are the corners themselves and, for soft cascades, the rejection trace, which is kept beside the code since
+ * hard cascades never look at it.
+ */
+class CascadeProgram {
+private:
+    std::vector<Instruction, AlignedAllocator<Instruction>> code;
+    fltvec rejectThresholds;    // WeakClassifier::rejectThreshold of every instruction
+    vec<ProgramStage> stages;
+
+public:
+    int windowSize;
+    int step;
+    size_t stride;
+
+    /**
+     * @brief Scale `cascade`, trained on windows of `trainedSize`, by `scale` and compile it for integrals with
+     * `stride`. Window positions of the program are `step` pixels apart.
+     * @param thresholds Threshold of every stage, see ModelStage.
+     */
+    CascadeProgram(const vec<classifiervec> &cascade, const fltvec &thresholds, int trainedSize, flt scale, int step,
+                   size_t stride);
+
+    /**
+     * @brief Windows evaluated by one runBatch(): 16 with AVX-512, 8 with AVX2 and 1 without either.
+     */
+    static int batchSize();
+
+    [[nodiscard]] size_t size() const { return code.size(); }
+
+    [[nodiscard]] const Instruction &instruction(size_t k) const { return code[k]; }
+
+    [[nodiscard]] flt rejectThreshold(size_t k) const { return rejectThresholds[k]; }
+
+    [[nodiscard]] size_t stageCount() const { return stages.size(); }
+
+    [[nodiscard]] const ProgramStage &stage(size_t i) const { return stages[i]; }
+
+    [[nodiscard]] size_t bytes() const {
+        return code.size() * sizeof(Instruction) + rejectThresholds.size() * sizeof(flt) +
+               stages.size() * sizeof(ProgramStage);
+    }
+
+    /**
+     * @brief Mean and standard deviation of the window whose integral and squared integral start at `window` and
+     * `squared`. Deviations below 1 are taken as 1.
+     */
+    [[nodiscard]] Stats windowStats(const ImgFlt *window, const ImgFlt *squared) const;
+
+    /**
+     * @brief Whether every stage accepts the window whose integral starts at `window`, normalized with `stats`.
+     * With `softCascade` a stage stops at the first instruction whose rejectThreshold the weighted sum falls below,
+     * and a calibrated stage accepts at the end of its trace. Adds the instructions executed to `evaluated`.
+     */
+    bool run(const ImgFlt *window, Stats stats, bool softCascade, size_t &evaluated) const;
+
+    /**
+     * @brief run() with windowStats() on the batchSize() windows `step` pixels apart whose first one starts at
+     * `window` and `squared`. The vector kernels load the same corner of neighbouring windows together and drop a lane
+     * once its window is rejected; they do the same arithmetic in the same order as the scalar code, so the result is
+     * identical.
+     * @return Bit i set when window i is accepted.
+     */
+    uint32_t runBatch(const ImgFlt *window, const ImgFlt *squared, bool softCascade, size_t &evaluated) const;
+};
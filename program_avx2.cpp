@@ -0,0 +1,60 @@
+// Compiled with -mavx2, only called after program.cpp has checked the CPU supports it.
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+#include "program_impl.h"
+
+namespace {
+
+struct Avx2Ops {
+    typedef __m256d V;
+    typedef __m256d M;
+    typedef __m128i I;
+    static constexpr int N = 4;
+
+    static V zero() { return _mm256_setzero_pd(); }
+
+    static V set1(double v) { return _mm256_set1_pd(v); }
+
+    static V load(const double *p) { return _mm256_loadu_pd(p); }
+
+    // The masked form, since GCC warns about the unmasked one reading an uninitialized source.
+    static V gather(const double *p, I index) {
+        const V all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), p, index, all, 8);
+    }
+
+    static I index(int step) { return _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(step)); }
+
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+
+    static V div(V a, V b) { return _mm256_div_pd(a, b); }
+
+    static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+
+    static M lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+
+    static M ge(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+
+    static M gt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+
+    static V select(M m, V v) { return _mm256_and_pd(m, v); }
+
+    static V blend(M m, V yes, V no) { return _mm256_blendv_pd(no, yes, m); }
+
+    static uint32_t bits(M m) { return (uint32_t) _mm256_movemask_pd(m); }
+};
+
+}
+
+uint32_t
+program_run_avx2(const CascadeProgram &program, const ImgFlt *window, const ImgFlt *squared,
+                 bool softCascade, size_t &evaluated) {
+    return run_batch<Avx2Ops>(program, window, squared, softCascade, evaluated);
+}
+
+#endif
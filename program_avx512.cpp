@@ -0,0 +1,62 @@
+// Compiled with -mavx512f, only called after program.cpp has checked the CPU supports it.
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+#include "program_impl.h"
+
+namespace {
+
+struct Avx512Ops {
+    typedef __m512d V;
+    typedef __mmask8 M;
+    typedef __m256i I;
+    static constexpr int N = 8;
+
+    static V zero() { return _mm512_setzero_pd(); }
+
+    static V set1(double v) { return _mm512_set1_pd(v); }
+
+    static V load(const double *p) { return _mm512_loadu_pd(p); }
+
+    // The masked forms, since GCC warns about the unmasked ones reading an uninitialized source.
+    static V gather(const double *p, I index) {
+        return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, index, p, 8);
+    }
+
+    static I index(int step) {
+        return _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(step));
+    }
+
+    static V add(V a, V b) { return _mm512_add_pd(a, b); }
+
+    static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+
+    static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+
+    static V div(V a, V b) { return _mm512_div_pd(a, b); }
+
+    // Masked like gather().
+    static V sqrt(V a) { return _mm512_maskz_sqrt_pd(0xFF, a); }
+
+    static M lt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+
+    static M ge(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+
+    static M gt(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+
+    static V select(M m, V v) { return _mm512_maskz_mov_pd(m, v); }
+
+    static V blend(M m, V yes, V no) { return _mm512_mask_blend_pd(m, no, yes); }
+
+    static uint32_t bits(M m) { return (uint32_t) m; }
+};
+
+}
+
+uint32_t
+program_run_avx512(const CascadeProgram &program, const ImgFlt *window, const ImgFlt *squared,
+                   bool softCascade, size_t &evaluated) {
+    return run_batch<Avx512Ops>(program, window, squared, softCascade, evaluated);
+}
+
+#endif
@@ -0,0 +1,146 @@
+#pragma once
+
+// Shared by the cascade program kernels of every instruction set. Only include from program*.cpp: the templates are
+// instantiated with per-translation-unit Ops types that are compiled for different ISAs.
+
+#include "program.h"
+
+/**
+ * @brief The same pixel of Ops::N neighbouring windows. Windows are `step` apart, so this is one contiguous load when
+ * step is 1 and a gather otherwise.
+ */
+template<typename Ops, bool Contiguous>
+inline typename Ops::V
+lanes(const ImgFlt *p, typename Ops::I index) {
+    if constexpr (Contiguous) return Ops::load(p);
+    else return Ops::gather(p, index);
+}
+
+/**
+ * @brief HaarKernel::evaluate() on Ops::N windows at once, summing the terms in the order of the scalar fold.
+ */
+template<typename Ops, bool Contiguous, FeatureType Type>
+inline typename Ops::V
+haar_lanes(const ImgFlt *origin, const int32_t *offsets, typename Ops::I index) {
+    typedef HaarKernel<Type> Kernel;
+    typename Ops::V acc = Ops::mul(Ops::set1((ImgFlt) Kernel::COEFS[0]),
+                                   lanes<Ops, Contiguous>(origin + offsets[0], index));
+    for (int k = 1; k < Kernel::N; ++k) {
+        acc = Ops::add(acc, Ops::mul(Ops::set1((ImgFlt) Kernel::COEFS[k]),
+                                     lanes<Ops, Contiguous>(origin + offsets[k], index)));
+    }
+    return acc;
+}
+
+/**
+ * @brief Sum of the window whose integral starts at `origin`, as in CascadeProgram::windowStats().
+ */
+template<typename Ops, bool Contiguous>
+inline typename Ops::V
+window_sum(const ImgFlt *origin, size_t right, size_t bottom, typename Ops::I index) {
+    return Ops::add(Ops::sub(Ops::sub(lanes<Ops, Contiguous>(origin + bottom + right, index),
+                                      lanes<Ops, Contiguous>(origin + right, index)),
+                             lanes<Ops, Contiguous>(origin + bottom, index)),
+                    lanes<Ops, Contiguous>(origin, index));
+}
+
+template<typename Ops, bool Contiguous>
+inline typename Ops::V
+response_lanes(const Instruction &ins, const ImgFlt *origin, typename Ops::I index) {
+    switch (ins.type) {
+        case FeatType2h:
+            return haar_lanes<Ops, Contiguous, FeatType2h>(origin, ins.offsets, index);
+        case FeatType2v:
+            return haar_lanes<Ops, Contiguous, FeatType2v>(origin, ins.offsets, index);
+        case FeatType3h:
+            return haar_lanes<Ops, Contiguous, FeatType3h>(origin, ins.offsets, index);
+        case FeatType3v:
+            return haar_lanes<Ops, Contiguous, FeatType3v>(origin, ins.offsets, index);
+        case FeatType4:
+            return haar_lanes<Ops, Contiguous, FeatType4>(origin, ins.offsets, index);
+    }
+    return Ops::zero();
+}
+
+/**
+ * @brief CascadeProgram::runBatch() on two registers of Ops::N windows.
+ *
+ * Ops describes one vector of doubles: N lanes, I the index vector of a gather, M a lane mask; set1, load, gather,
+ * add, sub, mul, div, sqrt, lt, gt and ge (ordered, i.e. false on NaN as in the scalar comparisons), select (the value
+ * where the mask is set, +0 elsewhere), blend and bits (the mask as an integer).
+ */
+template<typename Ops, bool Contiguous>
+inline uint32_t
+run_lanes(const CascadeProgram &program, const ImgFlt *window, const ImgFlt *squared, bool softCascade,
+          size_t &evaluated) {
+    typedef typename Ops::V V;
+    constexpr int N = Ops::N;
+    const size_t half = (size_t) N * program.step;
+    const typename Ops::I index = Ops::index(program.step);
+
+    const size_t right = program.windowSize;
+    const size_t bottom = program.windowSize * program.stride;
+    const V n = Ops::set1((flt) (program.windowSize * program.windowSize));
+    const V one = Ops::set1(1.0);
+    V mean[2];
+    V std[2];
+    for (int r = 0; r < 2; ++r) {
+        mean[r] = Ops::div(window_sum<Ops, Contiguous>(window + r * half, right, bottom, index), n);
+        V sum_sq = window_sum<Ops, Contiguous>(squared + r * half, right, bottom, index);
+        V var = Ops::sub(Ops::div(sum_sq, n), Ops::mul(mean[r], mean[r]));
+        V s = Ops::select(Ops::gt(var, Ops::zero()), Ops::sqrt(var));
+        std[r] = Ops::blend(Ops::lt(s, one), one, s);
+    }
+
+    uint32_t active = (1u << (2 * N)) - 1;
+    for (size_t s = 0; s < program.stageCount(); ++s) {
+        const ProgramStage &stage = program.stage(s);
+        const size_t end = stage.first + stage.count;
+        V sum[2] = {Ops::zero(), Ops::zero()};
+        if (!softCascade) evaluated += stage.count * __builtin_popcount(active);
+        for (size_t k = stage.first; k < end; ++k) {
+            const Instruction &ins = program.instruction(k);
+            const V polarity = Ops::set1((ImgFlt) ins.polarity);
+            const V threshold = Ops::set1(ins.threshold);
+            const V flat = Ops::set1(ins.flatResponse);
+            const V alpha = Ops::set1(ins.alpha);
+            for (int r = 0; r < 2; ++r) {
+                V t = Ops::add(Ops::mul(threshold, std[r]), Ops::mul(mean[r], flat));
+                V response = response_lanes<Ops, Contiguous>(ins, window + r * half, index);
+                auto hit = Ops::lt(Ops::mul(polarity, response), Ops::mul(polarity, t));
+                sum[r] = Ops::add(sum[r], Ops::select(hit, alpha));
+            }
+            if (softCascade) {
+                evaluated += __builtin_popcount(active);
+                const V reject = Ops::set1(program.rejectThreshold(k));
+                active &= ~(Ops::bits(Ops::lt(sum[0], reject)) | Ops::bits(Ops::lt(sum[1], reject)) << N);
+                if (!active) return 0;
+            }
+        }
+        if (!softCascade || !stage.calibrated) {
+            const V accept = Ops::set1(stage.alphaSum * stage.threshold);
+            active &= Ops::bits(Ops::ge(sum[0], accept)) | Ops::bits(Ops::ge(sum[1], accept)) << N;
+            if (!active) return 0;
+        }
+    }
+    return active;
+}
+
+template<typename Ops>
+inline uint32_t
+run_batch(const CascadeProgram &program, const ImgFlt *window, const ImgFlt *squared, bool softCascade,
+          size_t &evaluated) {
+    static_assert(2 * Ops::N <= PROGRAM_MAX_BATCH, "PROGRAM_MAX_BATCH is too small");
+    if (program.step == 1) return run_lanes<Ops, true>(program, window, squared, softCascade, evaluated);
+    return run_lanes<Ops, false>(program, window, squared, softCascade, evaluated);
+}
+
+#if defined(__x86_64__)
+
+uint32_t program_run_avx2(const CascadeProgram &program, const ImgFlt *window, const ImgFlt *squared,
+                          bool softCascade, size_t &evaluated);
+
+uint32_t program_run_avx512(const CascadeProgram &program, const ImgFlt *window, const ImgFlt *squared,
+                            bool softCascade, size_t &evaluated);
+
+#endif
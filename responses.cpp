@@ -0,0 +1,302 @@
+#include "responses.h"
+
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+
+#include "utils.h"
+
+#define RESPONSES_VERSION 1
+#define SORTED_INDEX_VERSION 1
+#define RESPONSE_BINS_VERSION 1
+
+static size_t
+quantization_bytes(const ResponseHeader &header) {
+    return header.format == ResponseInt16 ? header.features * 2 * sizeof(float) : 0;
+}
+
+static size_t
+rows_offset(size_t header_bytes) {
+    return (header_bytes + IMG_ALIGNMENT - 1) / IMG_ALIGNMENT * IMG_ALIGNMENT;
+}
+
+static size_t
+file_size(const ResponseHeader &header) {
+    size_t elem = header.format == ResponseInt16 ? sizeof(uint16_t) : sizeof(float);
+    return rows_offset(sizeof(ResponseHeader) + quantization_bytes(header)) + header.features * header.samples * elem;
+}
+
+static size_t
+file_size(const SortedIndexHeader &header) {
+    return rows_offset(sizeof(SortedIndexHeader)) + header.features * header.samples * sizeof(uint32_t);
+}
+
+static size_t
+edges_bytes(const ResponseBinsHeader &header) {
+    return header.features * (header.bins - 1) * sizeof(float);
+}
+
+static size_t
+file_size(const ResponseBinsHeader &header) {
+    size_t elem = header.bins <= 256 ? sizeof(uint8_t) : sizeof(uint16_t);
+    return rows_offset(sizeof(ResponseBinsHeader) + edges_bytes(header)) + header.features * header.samples * elem;
+}
+
+ResponseMatrix::ResponseMatrix(const std::string &path) {
+    this->path = path;
+    file = MappedFile::open(path);
+    header = reinterpret_cast<const ResponseHeader *>(file->data());
+    if (file->size() < sizeof(ResponseHeader) || std::memcmp(header->magic, "ODRM", 4) != 0 ||
+        header->version != RESPONSES_VERSION || file_size(*header) != file->size()) {
+        throw std::runtime_error("Not a valid response matrix: " + path);
+    }
+    quantization = reinterpret_cast<const float *>(file->data() + sizeof(ResponseHeader));
+    rows = file->data() + rows_offset(sizeof(ResponseHeader) + quantization_bytes(*header));
+}
+
+uint64_t
+ResponseMatrix::key(const FeatureTable &table, const SampleStore &samples, ResponseFormat format) {
+    uint64_t hash = fnv1a(&format, sizeof format);
+    hash = fnv1a(&table.stride, sizeof table.stride, hash);
+    hash = fnv1a(table.types.data(), table.types.size() * sizeof(FeatureType), hash);
+    hash = fnv1a(table.offsets.data(), table.offsets.size() * sizeof(int32_t), hash);
+    uint64_t store = samples.fileKey();
+    return fnv1a(&store, sizeof store, hash);
+}
+
+shdptr<ResponseMatrix>
+ResponseMatrix::open(const std::string &path) {
+    return shdptr<ResponseMatrix>(new ResponseMatrix(path));
+}
+
+shdptr<ResponseMatrix>
+ResponseMatrix::build(const std::string &path, const FeatureTable &table, const SampleStore &samples,
+                      ResponseFormat format) {
+    ResponseHeader header{};
+    std::memcpy(header.magic, "ODRM", 4);
+    header.version = RESPONSES_VERSION;
+    header.format = format;
+    header.key = key(table, samples, format);
+    header.features = table.size();
+    header.samples = samples.size();
+
+    auto out = MappedFile::create(path, file_size(header));
+    std::memcpy(out->data(), &header, sizeof header);
+    auto *quant = reinterpret_cast<float *>(out->data() + sizeof(ResponseHeader));
+    uchar *data = out->data() + rows_offset(sizeof(ResponseHeader) + quantization_bytes(header));
+    const size_t n = samples.size();
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (size_t f = 0; f < table.size(); ++f) {
+        if (format == ResponseFloat32) {
+            auto *row = reinterpret_cast<float *>(data) + f * n;
+            for (size_t i = 0; i < n; ++i) {
+                row[i] = (float) samples.response(table, f, i);
+            }
+            continue;
+        }
+
+        vec<ImgFlt> values(n);
+        ImgFlt min = std::numeric_limits<ImgFlt>::max();
+        ImgFlt max = std::numeric_limits<ImgFlt>::lowest();
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = samples.response(table, f, i);
+            min = std::min(min, values[i]);
+            max = std::max(max, values[i]);
+        }
+        ImgFlt step = max > min ? (max - min) / 65535.0 : 1.0;
+        quant[2 * f] = (float) min;
+        quant[2 * f + 1] = (float) step;
+        auto *row = reinterpret_cast<uint16_t *>(data) + f * n;
+        for (size_t i = 0; i < n; ++i) {
+            row[i] = (uint16_t) std::lround((values[i] - min) / step);
+        }
+    }
+
+    out->commit();
+    return open(path);
+}
+
+shdptr<ResponseMatrix>
+ResponseMatrix::loadOrBuild(const std::string &dir, const FeatureTable &table, const SampleStore &samples,
+                            ResponseFormat format) {
+    std::filesystem::create_directories(dir);
+    char name[64];
+    snprintf(name, sizeof name, "responses_%016llx_%s.bin", (unsigned long long) key(table, samples, format),
+             format == ResponseInt16 ? "i16" : "f32");
+    std::string path = (std::filesystem::path(dir) / name).string();
+
+    if (std::filesystem::exists(path)) {
+        printf("Using cached response matrix %s\n", path.c_str());
+        return open(path);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    printf("Building response matrix %s (%zu features x %zu samples)\n", path.c_str(), table.size(), samples.size());
+    auto matrix = build(path, table, samples, format);
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+    printf("Built response matrix in %lds\n", duration);
+    return matrix;
+}
+
+SortedIndex::SortedIndex(const std::string &path) {
+    this->path = path;
+    file = MappedFile::open(path);
+    header = reinterpret_cast<const SortedIndexHeader *>(file->data());
+    if (file->size() < sizeof(SortedIndexHeader) || std::memcmp(header->magic, "ODSI", 4) != 0 ||
+        header->version != SORTED_INDEX_VERSION || file_size(*header) != file->size()) {
+        throw std::runtime_error("Not a valid sorted index: " + path);
+    }
+    rows = reinterpret_cast<const uint32_t *>(file->data() + rows_offset(sizeof(SortedIndexHeader)));
+}
+
+shdptr<SortedIndex>
+SortedIndex::open(const std::string &path) {
+    return shdptr<SortedIndex>(new SortedIndex(path));
+}
+
+shdptr<SortedIndex>
+SortedIndex::build(const std::string &path, const ResponseMatrix &matrix) {
+    SortedIndexHeader header{};
+    std::memcpy(header.magic, "ODSI", 4);
+    header.version = SORTED_INDEX_VERSION;
+    header.key = matrix.fileKey();
+    header.features = matrix.features();
+    header.samples = matrix.samples();
+
+    auto out = MappedFile::create(path, file_size(header));
+    std::memcpy(out->data(), &header, sizeof header);
+    auto *data = reinterpret_cast<uint32_t *>(out->data() + rows_offset(sizeof(SortedIndexHeader)));
+    const size_t n = matrix.samples();
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (size_t f = 0; f < matrix.features(); ++f) {
+        uint32_t *row = data + f * n;
+        std::iota(row, row + n, 0);
+        // Ties are broken by column so the index does not depend on the sort implementation.
+        std::sort(row, row + n, [&matrix, f](uint32_t a, uint32_t b) {
+            ImgFlt ra = matrix.at(f, a);
+            ImgFlt rb = matrix.at(f, b);
+            return ra < rb || (ra == rb && a < b);
+        });
+    }
+
+    out->commit();
+    return open(path);
+}
+
+shdptr<SortedIndex>
+SortedIndex::loadOrBuild(const std::string &dir, const ResponseMatrix &matrix) {
+    std::filesystem::create_directories(dir);
+    char name[64];
+    snprintf(name, sizeof name, "sorted_%016llx_%s.bin", (unsigned long long) matrix.fileKey(),
+             matrix.format() == ResponseInt16 ? "i16" : "f32");
+    std::string path = (std::filesystem::path(dir) / name).string();
+
+    if (std::filesystem::exists(path)) {
+        printf("Using cached sorted index %s\n", path.c_str());
+        return open(path);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    printf("Building sorted index %s\n", path.c_str());
+    auto index = build(path, matrix);
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+    printf("Built sorted index in %lds\n", duration);
+    return index;
+}
+
+ResponseBins::ResponseBins(const std::string &path) {
+    this->path = path;
+    file = MappedFile::open(path);
+    header = reinterpret_cast<const ResponseBinsHeader *>(file->data());
+    if (file->size() < sizeof(ResponseBinsHeader) || std::memcmp(header->magic, "ODBN", 4) != 0 ||
+        header->version != RESPONSE_BINS_VERSION || file_size(*header) != file->size()) {
+        throw std::runtime_error("Not a valid response bins file: " + path);
+    }
+    edges = reinterpret_cast<const float *>(file->data() + sizeof(ResponseBinsHeader));
+    rows = file->data() + rows_offset(sizeof(ResponseBinsHeader) + edges_bytes(*header));
+}
+
+shdptr<ResponseBins>
+ResponseBins::open(const std::string &path) {
+    return shdptr<ResponseBins>(new ResponseBins(path));
+}
+
+shdptr<ResponseBins>
+ResponseBins::build(const std::string &path, const ResponseMatrix &matrix, uint32_t bins) {
+    if (bins < 2 || bins > 65536) {
+        throw std::runtime_error("Response bins must be between 2 and 65536, got " + std::to_string(bins));
+    }
+    ResponseBinsHeader header{};
+    std::memcpy(header.magic, "ODBN", 4);
+    header.version = RESPONSE_BINS_VERSION;
+    header.bins = bins;
+    header.key = matrix.fileKey();
+    header.features = matrix.features();
+    header.samples = matrix.samples();
+
+    auto out = MappedFile::create(path, file_size(header));
+    std::memcpy(out->data(), &header, sizeof header);
+    auto *edge_data = reinterpret_cast<float *>(out->data() + sizeof(ResponseBinsHeader));
+    uchar *data = out->data() + rows_offset(sizeof(ResponseBinsHeader) + edges_bytes(header));
+    const size_t n = matrix.samples();
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (size_t f = 0; f < matrix.features(); ++f) {
+        vec<ImgFlt> values(n);
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = matrix.at(f, i);
+        }
+        vec<ImgFlt> ordered = values;
+        std::sort(ordered.begin(), ordered.end());
+
+        // Edge b starts bin b + 1 at the (b + 1) / bins quantile. Repeated values share one bin.
+        float *edge = edge_data + f * (bins - 1);
+        uint32_t used = 0;
+        for (uint32_t b = 1; b < bins; ++b) {
+            auto e = (float) ordered[b * n / bins];
+            if (e > (float) ordered[0] && (used == 0 || e > edge[used - 1])) {
+                edge[used++] = e;
+            }
+        }
+        std::fill(edge + used, edge + bins - 1, std::numeric_limits<float>::infinity());
+
+        for (size_t i = 0; i < n; ++i) {
+            auto b = (uint32_t) (std::upper_bound(edge, edge + used, values[i],
+                                                  [](ImgFlt v, float e) { return v < (ImgFlt) e; }) - edge);
+            if (bins <= 256) {
+                data[f * n + i] = (uint8_t) b;
+            } else {
+                reinterpret_cast<uint16_t *>(data)[f * n + i] = (uint16_t) b;
+            }
+        }
+    }
+
+    out->commit();
+    return open(path);
+}
+
+shdptr<ResponseBins>
+ResponseBins::loadOrBuild(const std::string &dir, const ResponseMatrix &matrix, uint32_t bins) {
+    std::filesystem::create_directories(dir);
+    char name[80];
+    snprintf(name, sizeof name, "bins_%016llx_%s_%u.bin", (unsigned long long) matrix.fileKey(),
+             matrix.format() == ResponseInt16 ? "i16" : "f32", bins);
+    std::string path = (std::filesystem::path(dir) / name).string();
+
+    if (std::filesystem::exists(path)) {
+        printf("Using cached response bins %s\n", path.c_str());
+        return open(path);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    printf("Building response bins %s (%u bins)\n", path.c_str(), bins);
+    auto quantized = build(path, matrix, bins);
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+    printf("Built response bins in %lds\n", duration);
+    return quantized;
+}
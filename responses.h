@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include "feature_table.h"
+#include "mapped_file.h"
+#include "sample_store.h"
+
+enum ResponseFormat : uint32_t {
+    ResponseFloat32,
+    ResponseInt16
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t features;
+    uint64_t samples;
+} ResponseHeader;
+
+/**
+ * @brief Features x samples matrix of feature responses in a memory mapped file.
+ *
+ * Row f holds the response of feature f on every sample, so a boosting round streams through the file once instead of
+ * re-evaluating every feature on every integral. Int16 rows are quantized linearly per feature between the row's
+ * minimum and maximum, which keeps the order of the responses. Column i is sample i of the SampleStore it was built
+ * from. Files are named after a hash of the feature table, the sample store and the format, so they are reused by later
+ * stages and later runs over the same data.
+ */
+class ResponseMatrix {
+private:
+    shdptr<MappedFile> file;
+    const ResponseHeader *header = nullptr;
+    const float *quantization = nullptr;    // (min, step) per feature for ResponseInt16
+    const uchar *rows = nullptr;
+
+    explicit ResponseMatrix(const std::string &path);
+
+public:
+    std::string path;
+
+    static uint64_t key(const FeatureTable &table, const SampleStore &samples, ResponseFormat format);
+
+    static shdptr<ResponseMatrix> open(const std::string &path);
+
+    static shdptr<ResponseMatrix>
+    build(const std::string &path, const FeatureTable &table, const SampleStore &samples, ResponseFormat format);
+
+    /**
+     * @brief Open the matrix for this table and sample set from `dir`, building it first if it is not cached yet.
+     */
+    static shdptr<ResponseMatrix>
+    loadOrBuild(const std::string &dir, const FeatureTable &table, const SampleStore &samples, ResponseFormat format);
+
+    [[nodiscard]] uint64_t fileKey() const { return header->key; }
+
+    [[nodiscard]] size_t features() const { return header->features; }
+
+    [[nodiscard]] size_t samples() const { return header->samples; }
+
+    [[nodiscard]] ResponseFormat format() const { return (ResponseFormat) header->format; }
+
+    [[nodiscard]] ImgFlt at(size_t f, size_t sample) const {
+        if (format() == ResponseFloat32) {
+            return (ImgFlt) reinterpret_cast<const float *>(rows)[f * samples() + sample];
+        }
+        auto q = reinterpret_cast<const uint16_t *>(rows)[f * samples() + sample];
+        return (ImgFlt) quantization[2 * f] + (ImgFlt) quantization[2 * f + 1] * (ImgFlt) q;
+    }
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t features;
+    uint64_t samples;
+} SortedIndexHeader;
+
+/**
+ * @brief For every feature, the columns of a ResponseMatrix ordered by ascending response.
+ *
+ * The order of a feature's responses never changes between boosting rounds (only the weights do), so it is sorted once
+ * and each round is a linear scan. Stored memory mapped next to the matrix it was built from and keyed by it.
+ */
+class SortedIndex {
+private:
+    shdptr<MappedFile> file;
+    const SortedIndexHeader *header = nullptr;
+    const uint32_t *rows = nullptr;
+
+    explicit SortedIndex(const std::string &path);
+
+public:
+    std::string path;
+
+    static shdptr<SortedIndex> open(const std::string &path);
+
+    static shdptr<SortedIndex> build(const std::string &path, const ResponseMatrix &matrix);
+
+    static shdptr<SortedIndex> loadOrBuild(const std::string &dir, const ResponseMatrix &matrix);
+
+    [[nodiscard]] uint64_t fileKey() const { return header->key; }
+
+    [[nodiscard]] size_t features() const { return header->features; }
+
+    [[nodiscard]] size_t samples() const { return header->samples; }
+
+    [[nodiscard]] const uint32_t *row(size_t f) const { return rows + f * samples(); }
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t bins;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t features;
+    uint64_t samples;
+} ResponseBinsHeader;
+
+/**
+ * @brief Responses of a ResponseMatrix quantized to at most `bins` bins per feature.
+ *
+ * Bin edges are taken at quantiles of each feature's responses, so every bin holds about the same number of samples
+ * however the responses are distributed. A response r falls in the number of edges <= r, hence r < edge(f, b) exactly
+ * when its bin is at most b and a split between two bins is a threshold on the responses themselves. Unused trailing
+ * edges are +inf. Bins are stored as one byte when there are at most 256 of them.
+ */
+class ResponseBins {
+private:
+    shdptr<MappedFile> file;
+    const ResponseBinsHeader *header = nullptr;
+    const float *edges = nullptr;   // bins - 1 per feature
+    const uchar *rows = nullptr;
+
+    explicit ResponseBins(const std::string &path);
+
+public:
+    std::string path;
+
+    static shdptr<ResponseBins> open(const std::string &path);
+
+    static shdptr<ResponseBins> build(const std::string &path, const ResponseMatrix &matrix, uint32_t bins);
+
+    static shdptr<ResponseBins> loadOrBuild(const std::string &dir, const ResponseMatrix &matrix, uint32_t bins);
+
+    [[nodiscard]] uint64_t fileKey() const { return header->key; }
+
+    [[nodiscard]] uint32_t bins() const { return header->bins; }
+
+    [[nodiscard]] size_t features() const { return header->features; }
+
+    [[nodiscard]] size_t samples() const { return header->samples; }
+
+    /**
+     * @brief Lower edge of bin b + 1.
+     */
+    [[nodiscard]] ImgFlt edge(size_t f, uint32_t b) const { return (ImgFlt) edges[f * (bins() - 1) + b]; }
+
+    [[nodiscard]] uint32_t bin(size_t f, size_t sample) const {
+        if (bins() <= 256) return rows[f * samples() + sample];
+        return reinterpret_cast<const uint16_t *>(rows)[f * samples() + sample];
+    }
+};
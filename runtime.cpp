@@ -1,102 +1,254 @@
 #include "runtime.h"
 
-shdptr<Feature> copyFeature(const std::string &name, int x, int y, int width, int height) {
-    shdptr<Feature> f;
-    if (name == "2h") {
-        f = std::make_shared<Feature2h>(x, y, width, height);
-    } else if (name == "2v") {
-        f = std::make_shared<Feature2v>(x, y, width, height);
-    } else if (name == "3h") {
-        f = std::make_shared<Feature3h>(x, y, width, height);
-    } else if (name == "3v") {
-        f = std::make_shared<Feature3v>(x, y, width, height);
-    } else if (name == "4r") {
-        f = std::make_shared<Feature4>(x, y, width, height);
-    } else {
-        throw std::runtime_error("Unknown feature name: " + std::string(name));
-    }
-    return f;
+#include "integral.h"
+
+Runtime::Runtime(const vec<classifiervec> &cascade, fltvec thresholds, int windowSize, ScanOptions options,
+                 Scale frame) : options(options), cascade(cascade), stageThresholds(std::move(thresholds)),
+                                windowSize(windowSize), frame(frame) {
+    if (options.scaleFactor <= 1.0 || options.stride <= 0 || options.rowsPerTask < 1) {
+        throw std::runtime_error("Scanning needs a scale factor above 1, a positive stride and rowsPerTask");
+    }
+    if (stageThresholds.size() != cascade.size()) {
+        throw std::runtime_error("Every stage of the cascade needs a threshold");
+    }
+    programs = compile(frame, ImgType(1, frame.width + 1).stride);
+
+    size_t instructions = 0;
+    size_t bytes = 0;
+    for (const auto &program: programs) {
+        instructions += program.size();
+        bytes += program.bytes();
+    }
+    printf("Compiled %zu scales into %zu instructions, %.1f KiB.\n", programs.size(), instructions,
+           (double) bytes / 1024.0);
 }
 
-int
-scaleUp(int val, flt factor) {
-    return (int) ((flt) val * factor);
+Runtime::Runtime(const vec<classifiervec> &cascade, ScanOptions options, Scale frame)
+        : Runtime(cascade, fltvec(cascade.size(), 0.5), FEATURE_SIZE, options, frame) {}
+
+Runtime::Runtime(const CascadeModel &model, ScanOptions options, Scale frame)
+        : Runtime(model.cascade(), model.thresholds(), model.windowSize(), options, frame) {}
+
+vec<CascadeProgram>
+Runtime::compile(Scale frame, size_t stride) const {
+    vec<CascadeProgram> compiled;
+    for (flt scale = 1.0;; scale *= options.scaleFactor) {
+        int size = scaleUp(windowSize, scale);
+        if (size > frame.height || size > frame.width) break;
+        int step = std::max(1, (int) std::lround(options.stride * scale));
+        compiled.emplace_back(cascade, stageThresholds, windowSize, scale, step, stride);
+        // Pyramid levels are all scanned with the trained window.
+        if (options.mode == ScanPyramid) break;
+    }
+    return compiled;
 }
 
-Runtime::Runtime(vec<classifiervec> cascade) {
-    int scale_i = 0;
-    flt max_y = (flt) FEATURE_SIZE;
-    flt max_x = (flt) FEATURE_SIZE;
-    flt scale = 1.0;
-    size_t total = 0;
-    while (max_y < IM_HEIGHT && max_x < IM_WIDTH) {
-        cascadeAtScales.emplace_back();
-        cascadeAtScales[scale_i].reserve(cascade.size());
-        int layer_i = 0;
-        for (const auto &layer: cascade) {
-            cascadeAtScales[scale_i].emplace_back();
-            cascadeAtScales[scale_i][layer_i].reserve(layer.size());
-            for (const auto &c: layer) {
-                auto f = copyFeature(c.feat->name(), scaleUp(c.feat->x, scale), scaleUp(c.feat->y, scale),
-                                     scaleUp(c.feat->width, scale), scaleUp(c.feat->height, scale));
-                WeakClassifier wc{c.threshold, c.polarity, c.alpha, f};
-                cascadeAtScales[scale_i][layer_i].push_back(wc);
+void
+Runtime::scanRows(const ScanLayer &layer, int firstRow, int lastRow, boxes &found, ScanCount &count) const {
+    const ImgViewType &integral = layer.integral;
+    const ImgViewType &squared = layer.squared;
+    const CascadeProgram &program = *layer.program;
+    const int size = program.windowSize;
+    // Windows are reported in frame pixels.
+    const int frame_size = scaleUp(size, layer.scale);
+    const int batch = CascadeProgram::batchSize();
+    for (int row = firstRow; row < lastRow; ++row) {
+        int top = row * program.step;
+        int left = 0;
+        // Runs of neighbouring windows go to the vector kernel, the rest of the row one window at a time.
+        for (; batch > 1 && left + (batch - 1) * program.step + size < integral.width; left += batch * program.step) {
+            count.windows += batch;
+            uint32_t accepted = program.runBatch(integral[top] + left, squared[top] + left, options.softCascade,
+                                                 count.features);
+            for (int i = 0; i < batch; ++i) {
+                if (accepted >> i & 1) {
+                    found.push_back({{scaleUp(left + i * program.step, layer.scale), scaleUp(top, layer.scale)},
+                                     {frame_size,                                    frame_size}});
+                }
+            }
+        }
+        for (; left + size < integral.width; left += program.step) {
+            count.windows++;
+            // The features only read a handful of corners, so evaluate them in place on the full frame.
+            const ImgFlt *window = integral[top] + left;
+            Stats stats = program.windowStats(window, squared[top] + left);
+            if (program.run(window, stats, options.softCascade, count.features)) {
+                found.push_back({{scaleUp(left, layer.scale), scaleUp(top, layer.scale)},
+                                 {frame_size,                 frame_size}});
             }
-            layer_i++;
         }
-        scale_i++;
-        max_y = FEATURE_SIZE * scale;
-        max_x = FEATURE_SIZE * scale;
-        scale += SCALE_FACTOR;
-//        break;
     }
 }
 
-boxes
-Runtime::run(ImgType &img) const {
-    // (pos, size)
-    std::vector<std::tuple<XY, XY>> locs;
-
-    int scale_i = 0;
-    flt max_y = (flt) FEATURE_SIZE;
-    flt max_x = (flt) FEATURE_SIZE;
-    flt scale = 1.0;
-    size_t total = 0;
-
-    while (max_y < img.height && max_x < img.width) {
-        ImgType cropped((int) max_y, (int) max_x);
-        auto half_y = max_y / 2;
-        auto half_x = max_x / 2;
-        for (int y = (int) half_y; y + max_y < img.height; y++) {
-            for (int x = (int) half_x; x + max_x < img.width; x++) {
-                for (const auto &layer: cascadeAtScales[scale_i]) {
-                    cropped = img.cropForIntegral(x - half_x, y - half_y, (int) max_x, (int) max_y);
-                    StrongClassifierResult h = Learner::strongClassifier(cropped, layer);
-                    total++;
-                    if (!(h.weightedSum >= h.alphaSum * 0.5)) {
-                        goto exit;
-                    }
-                    // TODO: Threshold for strongClassifier save
-//                    int lbl = h.label();
-//                    if (lbl == 1) {
-//                        locs.push_back({{x,           y},
-//                                        {(int) max_x, (int) max_y}});
-//                    }
-                }
-                locs.push_back({{x - (int) half_x, y - (int) half_y},
-                                {(int) max_x,      (int) max_y}});
-                exit:;
-            }
+/**
+ * @brief Frame coordinate that pixel `i` of a copy downscaled by `scale` samples, as cv::resize with INTER_LINEAR maps
+ * it: ((i + 0.5) * scale - 0.5), as a pixel `index` of the `size` pixels and the weight `frac` of the next one.
+ */
+static inline void
+source_pixel(int i, flt scale, int size, int &index, flt &frac) {
+    flt s = std::max(0.0, ((flt) i + 0.5) * scale - 0.5);
+    index = std::min((int) s, size - 1);
+    frac = index < size - 1 ? s - (flt) index : 0.0;
+}
+
+void
+downscale(ImgViewType integral, flt scale, ImgView<ImgFlt> dst) {
+    const int height = integral.height - 1;
+    const int width = integral.width - 1;
+    vec<int> xs(dst.width);
+    fltvec fx(dst.width);
+    for (int x = 0; x < dst.width; ++x) {
+        source_pixel(x, scale, width, xs[x], fx[x]);
+    }
+    auto pixel = [&](int y, int x) {
+        return integral[y + 1][x + 1] - integral[y][x + 1] - integral[y + 1][x] + integral[y][x];
+    };
+    for (int y = 0; y < dst.height; ++y) {
+        int y0;
+        flt fy;
+        source_pixel(y, scale, height, y0, fy);
+        int y1 = std::min(y0 + 1, height - 1);
+        ImgFlt *out = dst[y];
+        for (int x = 0; x < dst.width; ++x) {
+            int x0 = xs[x];
+            int x1 = std::min(x0 + 1, width - 1);
+            ImgFlt top = pixel(y0, x0) + (pixel(y0, x1) - pixel(y0, x0)) * fx[x];
+            ImgFlt bottom = pixel(y1, x0) + (pixel(y1, x1) - pixel(y1, x0)) * fx[x];
+            out[x] = top + (bottom - top) * fy;
+        }
+    }
+}
+
+vec<ScanLayer>
+Runtime::buildPyramid(ImgViewType integral, ImgViewType squared, const CascadeProgram &program) const {
+    typedef struct {
+        flt scale;
+        int height;
+        int width;
+        size_t offset;  // of the level's pixels in pyramidArena, followed by its integral and squared integral
+    } Level;
+
+    // Every level keeps the frame's stride, so the one program compiled for it reads all of them.
+    const size_t stride = integral.stride;
+    vec<Level> levels;
+    size_t used = 0;
+    for (flt scale = options.scaleFactor;; scale *= options.scaleFactor) {
+        int width = (int) ((flt) (integral.width - 1) / scale);
+        int height = (int) ((flt) (integral.height - 1) / scale);
+        if (width < windowSize || height < windowSize) break;
+        levels.push_back({scale, height, width, used});
+        used += ((size_t) height + 2 * (height + 1)) * stride;
+    }
+    if (pyramidArena.size() < used) {
+        pyramidArena.resize(used);
+    }
+
+    ImgFlt *arena = pyramidArena.data();
+    ThreadPool::shared().parallelFor(levels.size(), 1, [&](size_t, size_t begin, size_t end) {
+        for (size_t l = begin; l < end; ++l) {
+            const Level &level = levels[l];
+            ImgFlt *pixels = arena + level.offset;
+            ImgFlt *sum = pixels + (size_t) level.height * stride;
+            ImgFlt *sqsum = sum + (size_t) (level.height + 1) * stride;
+            downscale(integral, level.scale, {pixels, level.height, level.width, stride});
+            ::integral(pixels, stride, level.height, level.width, sum, stride, sqsum, stride);
         }
+    });
+
+    vec<ScanLayer> layers = {{integral, squared, &program, 1.0}};
+    for (const Level &level: levels) {
+        const ImgFlt *sum = arena + level.offset + (size_t) level.height * stride;
+        const ImgFlt *sqsum = sum + (size_t) (level.height + 1) * stride;
+        layers.push_back({{sum, level.height + 1, level.width + 1, stride},
+                          {sqsum, level.height + 1, level.width + 1, stride}, &program, level.scale});
+    }
+    return layers;
+}
+
+boxes
+Runtime::run(ImgViewType integral, ImgViewType squared) const {
+    ScanCount count{0, 0, 0};
+    boxes locs = run(integral, squared, count);
+    printf("Found %zu faces out of %zu windows at %zu scales, %.2f features per window.\n", locs.size(),
+           count.windows, count.scales, count.windows ? (double) count.features / (double) count.windows : 0.0);
+    return locs;
+}
+
+boxes
+Runtime::run(ImgViewType integral, ImgViewType squared, ScanCount &count) const {
+    count = {0, 0, 0};
+    if (squared.stride != integral.stride) {
+        throw std::runtime_error("The integral and the squared integral must have the same layout");
+    }
+    vec<CascadeProgram> fitted;
+    const vec<CascadeProgram> *compiled = &programs;
+    if (programs.empty() || integral.stride != programs.front().stride || integral.width - 1 > frame.width ||
+        integral.height - 1 > frame.height) {
+        fitted = compile({integral.width - 1, integral.height - 1}, integral.stride);
+        compiled = &fitted;
+    }
+    if (compiled->empty()) return {};
+
+    if (options.mode == ScanPyramid) {
+        std::lock_guard<std::mutex> lock(pyramidLock);
+        return scan(buildPyramid(integral, squared, compiled->front()), count);
+    }
+    vec<ScanLayer> layers;
+    for (const auto &program: *compiled) {
+        layers.push_back({integral, squared, &program, 1.0});
+    }
+    return scan(layers, count);
+}
 
-        scale_i++;
-        max_y = FEATURE_SIZE * scale;
-        max_x = FEATURE_SIZE * scale;
-        scale += SCALE_FACTOR;
-        break;
+boxes
+Runtime::scan(const vec<ScanLayer> &layers, ScanCount &count) const {
+    typedef struct {
+        size_t layer;
+        int firstRow;
+        int lastRow;
+    } Task;
+
+    // Window rows of every layer the window fits, cut into tasks. Large windows come first: their tasks are
+    // the slowest per window, so they should not be the ones left over at the end.
+    count = {0, 0, 0};
+    vec<Task> tasks;
+    for (size_t l = 0; l < layers.size(); ++l) {
+        const ScanLayer &layer = layers[l];
+        const CascadeProgram &program = *layer.program;
+        if (program.windowSize + 1 > layer.integral.height || program.windowSize + 1 > layer.integral.width) continue;
+        count.scales++;
+        int rows = (layer.integral.height - 1 - program.windowSize) / program.step + 1;
+        for (int row = 0; row < rows; row += options.rowsPerTask) {
+            tasks.push_back({l, row, std::min(rows, row + options.rowsPerTask)});
+        }
     }
+    std::stable_sort(tasks.begin(), tasks.end(), [&](const Task &a, const Task &b) {
+        return layers[a.layer].program->windowSize > layers[b.layer].program->windowSize;
+    });
 
-    printf("Found %zu faces out of %zu windows.\n", locs.size(), total);
+    ThreadPool &pool = ThreadPool::shared();
+    vec<boxes> found(pool.size());
+    vec<ScanCount> counts(pool.size(), {0, 0, 0});
+    pool.parallelFor(tasks.size(), 1, [&](size_t worker, size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const Task &task = tasks[t];
+            scanRows(layers[task.layer], task.firstRow, task.lastRow, found[worker], counts[worker]);
+        }
+    });
+
+    boxes locs;
+    for (size_t w = 0; w < found.size(); ++w) {
+        locs.insert(locs.end(), found[w].begin(), found[w].end());
+        count.windows += counts[w].windows;
+        count.features += counts[w].features;
+    }
+    std::sort(locs.begin(), locs.end(), [](const auto &a, const auto &b) {
+        auto [ax, ay] = std::get<0>(a);
+        auto [bx, by] = std::get<0>(b);
+        int as = std::get<1>(a).x;
+        int bs = std::get<1>(b).x;
+        return std::tie(as, ay, ax) < std::tie(bs, by, bx);
+    });
     return locs;
 }
 
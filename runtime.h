@@ -1,19 +1,137 @@
 #pragma once
 
+#include <mutex>
 #include "constants.h"
 #include "learner.h"
+#include "model.h"
+#include "parallel.h"
+#include "program.h"
 
 typedef std::vector<std::tuple<XY, XY>> boxes;
 
+/**
+ * @brief How windows larger than the trained one are scanned. The modes do not accept the same windows: scaled features
+ * sum rectangles of the full resolution frame, while the pyramid resamples the frame bilinearly like the training
+ * crops. bench_pyramid() measures the gap; on its synthetic frames the pyramid has about ten times the false positives
+ * per window of scaled features (3.0e-05 against 2.8e-06), so ScanScaledFeatures stays the default.
+ */
+enum ScanMode {
+    ScanScaledFeatures,     // scale the cascade's features to every window size
+    ScanPyramid             // scale the frame down level by level and scan every level with the trained window
+};
+
+typedef struct {
+    flt scaleFactor;    // window size ratio between neighbouring scales
+    flt stride;         // window step in pixels at scale 1, multiplied by the scale (at least 1)
+    int rowsPerTask;    // window rows of one scale scanned by one pool task
+    bool softCascade;   // stop a layer as soon as a window falls below its rejection trace, see WeakClassifier
+    ScanMode mode;
+} ScanOptions;
+
+typedef struct {
+    size_t windows;
+    size_t features;    // weak classifiers evaluated
+    size_t scales;      // layers the window fits
+} ScanCount;
+
+/**
+ * @brief An integral image scanned with one program. The frame itself, or one level of its pyramid.
+ */
+typedef struct {
+    ImgViewType integral;
+    ImgViewType squared;
+    const CascadeProgram *program;
+    flt scale;          // frame pixels per pixel of the integral
+} ScanLayer;
+
+/**
+ * @brief Bilinear downscale of the frame whose integral is `integral` by `scale` into `dst`, the same resampling that
+ * resizes the training crops to the window (see sample_data), so a window on a level looks like a training sample.
+ * The frame pixels are read back from the integral, which holds them exactly.
+ */
+void downscale(ImgViewType integral, flt scale, ImgView<ImgFlt> dst);
+
 class Runtime {
 private:
-    vec<vec<classifiervec>> cascadeAtScales;
+    ScanOptions options;
+    vec<classifiervec> cascade;
+    fltvec stageThresholds;
+    int windowSize;
+    Scale frame;
+    vec<CascadeProgram> programs;   // compiled for integrals of `frame`
+    mutable std::mutex pyramidLock;
+    mutable std::vector<ImgFlt, AlignedAllocator<ImgFlt>> pyramidArena;  // levels of the last frame, reused by the next
+
+    /**
+     * @brief The cascade compiled at every scale that fits `frame`, growing by options.scaleFactor, for integrals with
+     * `stride`.
+     */
+    [[nodiscard]] vec<CascadeProgram> compile(Scale frame, size_t stride) const;
+
+    /**
+     * @brief The frame and its levels, each options.scaleFactor smaller than the one before down to the window size.
+     * Levels are resampled from `integral` and integrated in parallel into pyramidArena, with the frame's stride so
+     * that `program` (at scale 1) reads all of them. Call with pyramidLock held.
+     */
+    [[nodiscard]] vec<ScanLayer>
+    buildPyramid(ImgViewType integral, ImgViewType squared, const CascadeProgram &program) const;
+
+    /**
+     * @brief Scan every layer on the shared ThreadPool, see run(). Sets `count` to the work done.
+     */
+    [[nodiscard]] boxes scan(const vec<ScanLayer> &layers, ScanCount &count) const;
+
+    /**
+     * @brief Windows of `layer` whose top left corners are on rows [firstRow, lastRow) of its program's grid, appended
+     * to `found` in frame pixels. Adds the work done to `count`.
+     */
+    void scanRows(const ScanLayer &layer, int firstRow, int lastRow, boxes &found, ScanCount &count) const;
+
 public:
-    Runtime(vec<classifiervec> cascade);
+    /**
+     * @brief Compile the cascade, trained on windows of `windowSize`, to a CascadeProgram at every window size that
+     * fits `frame`, growing by options.scaleFactor.
+     * @param thresholds Threshold of every stage, see ModelStage.
+     */
+    Runtime(const vec<classifiervec> &cascade, fltvec thresholds, int windowSize, ScanOptions options,
+            Scale frame = {IM_WIDTH, IM_HEIGHT});
+
+    /**
+     * @brief A cascade trained on FEATURE_SIZE windows whose stages all accept at half their alpha sum.
+     */
+    explicit Runtime(const vec<classifiervec> &cascade,
+                     ScanOptions options = {SCALE_FACTOR, 1.0, 4, false, ScanScaledFeatures},
+                     Scale frame = {IM_WIDTH, IM_HEIGHT});
+
+    explicit Runtime(const CascadeModel &model, ScanOptions options = {SCALE_FACTOR, 1.0, 4, false, ScanScaledFeatures},
+                     Scale frame = {IM_WIDTH, IM_HEIGHT});
 
     ~Runtime() = default;
 
-    boxes run(ImgType &img) const;
+    /**
+     * @brief Scan a frame at every scale that fits it. Windows are variance normalized on the fly from the squared
+     * integral.
+     *
+     * With ScanScaledFeatures the frame is scanned once per scale with the features scaled to the window. With
+     * ScanPyramid the trained window scans the frame and every level of its pyramid (see buildPyramid()), so features
+     * keep their trained coordinates; the pyramid's buffers are reused from frame to frame, so pyramid scans of one
+     * runtime do not overlap.
+     *
+     * Frames of another size than the one the runtime was built for are scanned with programs compiled for them on
+     * the fly. Every scale is split into tasks of options.rowsPerTask window rows, and all tasks of all scales are run
+     * on the shared ThreadPool, whose workers steal tasks from each other when they run out. Within a row, runs of
+     * CascadeProgram::batchSize() windows go through the vector kernel. Each worker collects its detections in its own
+     * buffer; the buffers are merged and sorted by size and position, so the result does not depend on the number of
+     * threads.
+     * @param integral Integral of the (unnormalized) gray scale frame.
+     * @param squared Integral of the squared gray scale frame.
+     */
+    boxes run(ImgViewType integral, ImgViewType squared) const;
+
+    /**
+     * @brief run() without printing a summary, with the work done set in `count`.
+     */
+    boxes run(ImgViewType integral, ImgViewType squared, ScanCount &count) const;
 
     static void drawBoxes(cv::Mat &img, const boxes &b);
-};
\ No newline at end of file
+};
@@ -0,0 +1,144 @@
+#include "sample_store.h"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+
+#define SAMPLE_STORE_VERSION 1
+#define SAMPLE_INT32_SCALE (1.0 / 65536.0)
+
+static size_t
+value_bytes(SampleFormat format) {
+    return format == SampleFloat64 ? sizeof(double) : sizeof(float);
+}
+
+static size_t
+aligned(size_t bytes) {
+    return (bytes + IMG_ALIGNMENT - 1) / IMG_ALIGNMENT * IMG_ALIGNMENT;
+}
+
+SampleStore::SampleStore(const std::string &path) {
+    this->path = path;
+    file = MappedFile::open(path);
+    header = reinterpret_cast<const SampleStoreHeader *>(file->data());
+    if (file->size() < sizeof(SampleStoreHeader) || std::memcmp(header->magic, "ODSS", 4) != 0 ||
+        header->version != SAMPLE_STORE_VERSION ||
+        file->size() != aligned(sizeof(SampleStoreHeader)) + header->samples * header->sampleBytes) {
+        throw std::runtime_error("Not a valid sample store: " + path);
+    }
+    samples = file->data() + aligned(sizeof(SampleStoreHeader));
+}
+
+shdptr<SampleStore>
+SampleStore::open(const std::string &path) {
+    return shdptr<SampleStore>(new SampleStore(path));
+}
+
+shdptr<SampleStore>
+SampleStore::create(const std::string &dir, SampleFormat format, int height, int width, size_t count,
+                    const std::function<void(size_t, ImgFlt *)> &sample) {
+    SampleStoreHeader header{};
+    std::memcpy(header.magic, "ODSS", 4);
+    header.version = SAMPLE_STORE_VERSION;
+    header.format = format;
+    header.height = height;
+    header.width = width;
+    header.sampleBytes = aligned((size_t) height * width * value_bytes(format));
+    header.samples = count;
+    header.scale = format == SampleInt32 ? SAMPLE_INT32_SCALE : 1.0;
+
+    // The name depends on the contents, so write under a temporary name first.
+    std::filesystem::create_directories(dir);
+    std::string building = (std::filesystem::path(dir) / ("samples_" + std::to_string(getpid()) + ".bin")).string();
+    auto out = MappedFile::create(building, aligned(sizeof header) + count * header.sampleBytes);
+    uchar *data = out->data() + aligned(sizeof header);
+
+    const size_t n = (size_t) height * width;
+    vec<ImgFlt> values(n);
+    uint64_t key = fnv1a(&header, sizeof header);
+    for (size_t i = 0; i < count; ++i) {
+        sample(i, values.data());
+        uchar *dst = data + i * header.sampleBytes;
+        for (size_t k = 0; k < n; ++k) {
+            switch (format) {
+                case SampleFloat64:
+                    reinterpret_cast<double *>(dst)[k] = values[k];
+                    break;
+                case SampleFloat32:
+                    reinterpret_cast<float *>(dst)[k] = (float) values[k];
+                    break;
+                case SampleInt32: {
+                    double q = std::round(values[k] / SAMPLE_INT32_SCALE);
+                    if (std::abs(q) > (double) INT32_MAX) {
+                        throw std::runtime_error("Sample value " + std::to_string(values[k]) + " does not fit Int32");
+                    }
+                    reinterpret_cast<int32_t *>(dst)[k] = (int32_t) q;
+                    break;
+                }
+            }
+        }
+        key = fnv1a(dst, header.sampleBytes, key);
+    }
+    header.key = key;
+    std::memcpy(out->data(), &header, sizeof header);
+    out->commit();
+
+    char name[64];
+    snprintf(name, sizeof name, "samples_%016llx.bin", (unsigned long long) key);
+    std::string path = (std::filesystem::path(dir) / name).string();
+    std::filesystem::rename(building, path);
+    return open(path);
+}
+
+shdptr<SampleStore>
+SampleStore::create(const std::string &dir, SampleFormat format, const vec<shdptr<ImgType>> &integrals) {
+    if (integrals.empty()) throw std::runtime_error("A sample store needs at least one sample");
+    const int height = integrals[0]->height;
+    const int width = integrals[0]->width;
+    return create(dir, format, height, width, integrals.size(), [&](size_t i, ImgFlt *values) {
+        const ImgType &im = *integrals[i];
+        if (im.height != height || im.width != width) {
+            throw std::runtime_error("All samples of a store must have the same size");
+        }
+        for (int y = 0; y < height; ++y) {
+            std::memcpy(values + (size_t) y * width, im.row(y), width * sizeof(ImgFlt));
+        }
+    });
+}
+
+shdptr<SampleStore>
+SampleStore::create(const std::string &dir, SampleFormat format, images &ims) {
+    if (ims.empty()) throw std::runtime_error("A sample store needs at least one sample");
+    const int height = ims[0].height + 1;
+    const int width = ims[0].width + 1;
+    return create(dir, format, height, width, ims.size(), [&](size_t i, ImgFlt *values) {
+        ims[i].normalize(SAMPLE_MIN_STD);
+        ImgType integral = ims[i].toIntegral();
+        if (integral.height != height || integral.width != width) {
+            throw std::runtime_error("All samples of a store must have the same size");
+        }
+        for (int y = 0; y < height; ++y) {
+            std::memcpy(values + (size_t) y * width, integral.row(y), width * sizeof(ImgFlt));
+        }
+        ims[i] = ImgType(0, 0);
+    });
+}
+
+void
+SampleStore::read(size_t i, ImgFlt *values) const {
+    const size_t n = (size_t) height() * width();
+    for (size_t k = 0; k < n; ++k) {
+        switch (format()) {
+            case SampleFloat64:
+                values[k] = data<double>(i)[k];
+                break;
+            case SampleFloat32:
+                values[k] = data<float>(i)[k];
+                break;
+            case SampleInt32:
+                values[k] = data<int32_t>(i)[k] * scale();
+                break;
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include "feature_table.h"
+#include "mapped_file.h"
+#include "utils.h"
+
+enum SampleFormat : uint32_t {
+    SampleFloat64,
+    SampleFloat32,
+    SampleInt32     // fixed point, multiples of SampleStore::scale()
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t height;
+    uint32_t width;
+    uint32_t reserved;
+    uint64_t sampleBytes;   // distance between samples, a multiple of IMG_ALIGNMENT
+    uint64_t samples;
+    uint64_t key;
+    double scale;
+} SampleStoreHeader;
+
+/**
+ * @brief Integral images of training samples packed into a memory mapped file.
+ *
+ * Every sample is height x width values, row major without padding, and starts IMG_ALIGNMENT aligned at a fixed
+ * distance from the previous one, so a sample is found by its index and nothing is allocated per sample. The file is
+ * paged in on demand, so sets far larger than memory can be trained on. Float32 and Int32 take half the space of
+ * Float64. Int32 rounds every integral value to the nearest multiple of scale() (2^-16) and Float32 to about 7
+ * significant digits.
+ *
+ * Learners and response matrices refer to samples by their index in the store.
+ */
+class SampleStore {
+private:
+    shdptr<MappedFile> file;
+    const SampleStoreHeader *header = nullptr;
+    const uchar *samples = nullptr;
+
+    explicit SampleStore(const std::string &path);
+
+public:
+    std::string path;
+
+    static shdptr<SampleStore> open(const std::string &path);
+
+    /**
+     * @brief Write `count` samples of height x width values, filled in by `sample(i, values)`, to a file in `dir` named
+     * after a hash of the stored values. A store with the same contents is replaced.
+     */
+    static shdptr<SampleStore>
+    create(const std::string &dir, SampleFormat format, int height, int width, size_t count,
+           const std::function<void(size_t, ImgFlt *)> &sample);
+
+    static shdptr<SampleStore>
+    create(const std::string &dir, SampleFormat format, const vec<shdptr<ImgType>> &integrals);
+
+    /**
+     * @brief Store the integrals of `ims`, each normalized with its own mean and deviation like the Runtime normalizes
+     * a window. Each image is released once it is stored, so the integrals never all sit in memory at once.
+     */
+    static shdptr<SampleStore> create(const std::string &dir, SampleFormat format, images &ims);
+
+    [[nodiscard]] uint64_t fileKey() const { return header->key; }
+
+    [[nodiscard]] SampleFormat format() const { return (SampleFormat) header->format; }
+
+    [[nodiscard]] size_t size() const { return header->samples; }
+
+    [[nodiscard]] int height() const { return (int) header->height; }
+
+    [[nodiscard]] int width() const { return (int) header->width; }
+
+    /**
+     * @brief Row stride for FeatureTables evaluated on the samples.
+     */
+    [[nodiscard]] size_t stride() const { return header->width; }
+
+    [[nodiscard]] ImgFlt scale() const { return header->scale; }
+
+    template<typename T>
+    [[nodiscard]] const T *data(size_t i) const {
+        return reinterpret_cast<const T *>(samples + i * header->sampleBytes);
+    }
+
+    /**
+     * @brief Response of feature f of `table`, compiled for stride(), on sample i.
+     */
+    [[nodiscard]] ImgFlt response(const FeatureTable &table, size_t f, size_t i) const {
+        switch (format()) {
+            case SampleFloat32:
+                return table.evaluate(f, data<float>(i));
+            case SampleInt32:
+                return table.evaluate(f, data<int32_t>(i)) * scale();
+            case SampleFloat64:
+                break;
+        }
+        return table.evaluate(f, data<ImgFlt>(i));
+    }
+
+    /**
+     * @brief Copy sample i into `values` (height x width).
+     */
+    void read(size_t i, ImgFlt *values) const;
+};
@@ -1,11 +1,26 @@
 #include "utils.h"
 
+#include "image_store.h"
+#include "parallel.h"
+
+std::mt19937 &
+rng() {
+    static std::mt19937 gen(std::random_device{}());
+    return gen;
+}
+
+void
+seed_rng(uint32_t seed) {
+    rng().seed(seed);
+}
+
 std::vector<std::string>
 list_dir(const std::string &path) {
     std::vector<std::string> paths;
     for (const auto &entry: std::filesystem::directory_iterator(path)) {
         paths.push_back(entry.path());
     }
+    std::sort(paths.begin(), paths.end());
     return paths;
 }
 
@@ -39,7 +54,7 @@ merge_images(const std::vector<ImgType> &images) {
     // set all pixels to 0
     for (int y = 0; y < max_height; ++y) {
         for (int x = 0; x < total_width; ++x) {
-            merged.arr[y][x] = 0;
+            merged[y][x] = 0;
         }
     }
 
@@ -47,7 +62,7 @@ merge_images(const std::vector<ImgType> &images) {
     for (const auto &im: images) {
         for (int y = 0; y < im.height; ++y) {
             for (int x = 0; x < im.width; ++x) {
-                merged.arr[y][x + curr_width] = im.arr[y][x];
+                merged[y][x + curr_width] = im[y][x];
             }
         }
         curr_width += (int) im.width;
@@ -56,58 +71,98 @@ merge_images(const std::vector<ImgType> &images) {
     return merged;
 }
 
+std::vector<size_t>
+sample_indices(size_t count, size_t n) {
+    std::vector<size_t> result;
+    std::mt19937 &gen = rng();
+    std::uniform_int_distribution<> distrib(0, (int) count - 1);
+
+    for (size_t i = 0; i < n; ++i) {
+        result.push_back(distrib(gen));
+    }
+
+    return result;
+}
+
 std::vector<std::unique_ptr<std::string>>
 sample_paths(const paths &ims, size_t n) {
     std::vector<std::unique_ptr<std::string>> result;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distrib(0, (int) ims.size() - 1);
-
-    for (size_t i = 0; i < n; ++i) {
-        int index = distrib(gen);
+    for (size_t index: sample_indices(ims.size(), n)) {
         result.push_back(std::make_unique<std::string>(ims[index]));
     }
-
     return result;
 }
 
 images
 sample_faces(const paths &ims, size_t n) {
-    auto paths = sample_paths(ims, n);
+    auto store = ImageStore::loadOrBuild(CACHE_DIR, ims, StoreFaces);
     std::vector<ImgType> result;
-    for (const auto &path: paths) {
-        result.push_back(open_face(*path));
+    for (size_t index: sample_indices(ims.size(), n)) {
+        result.push_back(store->image(index));
     }
     return result;
 }
 
+/**
+ * @brief Square crop of an image of the given size: (left, top, size).
+ */
+static std::tuple<int, int, int>
+draw_crop(int height, int width) {
+    std::mt19937 &gen = rng();
+
+    int max_size = std::min(height, width);
+    int size = std::uniform_int_distribution<>(FEATURE_SIZE, max_size)(gen);
+    int max_width = width - size - 1;
+    int max_height = height - size - 1;
+
+    int left = max_width <= 1 ? 0 : std::uniform_int_distribution<>(0, max_width)(gen);
+    int top = max_height <= 1 ? 0 : std::uniform_int_distribution<>(0, max_height)(gen);
+    return {left, top, size};
+}
+
 images
 sample_backgrounds(const paths &ims, size_t n, bool resize) {
-    auto paths = sample_paths(ims, n);
-    images result;
-    for (const auto &path: paths) {
-        result.push_back(open_background(*path, resize));
+    auto store = ImageStore::loadOrBuild(CACHE_DIR, ims, StoreFrames);
+
+    // Every random choice is drawn up front and in order, so the samples do not depend on the number of threads.
+    auto indices = sample_indices(ims.size(), n);
+    std::vector<std::tuple<int, int, int>> crops;
+    for (size_t index: indices) {
+        crops.push_back(draw_crop(store->height(index), store->width(index)));
     }
+
+    images result(n, ImgType(0, 0));
+    ThreadPool::shared().parallelFor(n, 64, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto [left, top, size] = crops[i];
+            const size_t index = indices[i];
+            // Resize straight from the stored 8 bit pixels; Img::resize would convert the crop back to them first.
+            cv::Mat frame(store->height(index), store->width(index), CV_8UC1, (void *) store->pixels(index),
+                          (size_t) store->width(index));
+            cv::Mat crop = frame(cv::Rect(left, top, size, size));
+            if (resize) cv::resize(crop, crop, cv::Size(FEATURE_SIZE, FEATURE_SIZE));
+
+            ImgType im(crop.rows, crop.cols);
+            for (int y = 0; y < crop.rows; ++y) {
+                const uchar *src = crop.ptr<uchar>(y);
+                for (int x = 0; x < crop.cols; ++x) {
+                    im[y][x] = (ImgFlt) src[x];
+                }
+            }
+            result[i] = im;
+        }
+    });
     return result;
 }
 
 ImgType
 random_crop(const ImgType &img) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-
-    int max_size = std::min(img.height, img.width);
-    int size = std::uniform_int_distribution<>(FEATURE_SIZE, max_size)(gen);
-    int max_width = img.width - size - 1;
-    int max_height = img.height - size - 1;
-
-    int left = max_width <= 1 ? 0 : std::uniform_int_distribution<>(0, max_width)(gen);
-    int top = max_height <= 1 ? 0 : std::uniform_int_distribution<>(0, max_height)(gen);
+    auto [left, top, size] = draw_crop(img.height, img.width);
 
     ImgType cropped(size, size);
     for (int y = 0; y < size; ++y) {
         for (int x = 0; x < size; x++) {
-            cropped.arr[y][x] = img.arr[y + top][x + left];
+            cropped[y][x] = img[y + top][x + left];
         }
     }
     return cropped;
@@ -147,31 +202,12 @@ sample_data(int n_faces, int n_bgs, const paths &faces, const paths &bgs) {
     return samples;
 }
 
-Stats
-compute_stats(const images &ims) {
-    double mean = 0;
-    double std = 0;
-    size_t total = 0;
-    for (const auto &im: ims) {
-        for (int y = 0; y < im.height; ++y) {
-            for (int x = 0; x < im.width; ++x) {
-                mean += im.arr[y][x];
-                total++;
-            }
-        }
-    }
-    mean /= (double) total;
-
-    for (const auto &im: ims) {
-        for (int y = 0; y < im.height; ++y) {
-            for (int x = 0; x < im.width; ++x) {
-                std += std::pow(im.arr[y][x] - mean, 2);
-            }
-        }
+uint64_t
+fnv1a(const void *data, size_t n, uint64_t hash) {
+    const auto *bytes = static_cast<const uchar *>(data);
+    for (size_t i = 0; i < n; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
     }
-    std /= (double) total;
-    std = std::sqrt(std);
-
-    return Stats{mean, std};
+    return hash;
 }
-
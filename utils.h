@@ -17,11 +17,19 @@ typedef struct {
     std::vector<int> labels;
 } Samples;
 
-typedef struct {
-    double mean;
-    double std;
-} Stats;
-
+/**
+ * @brief Generator behind every random choice of the dataset sampling. Seeded from std::random_device until seed_rng()
+ * is called; a fixed seed makes the sampled training and validation sets reproducible.
+ */
+std::mt19937 &
+rng();
+
+void
+seed_rng(uint32_t seed);
+
+/**
+ * @brief Entries of a directory, sorted so that seeded sampling picks the same files on every run.
+ */
 paths
 list_dir(const std::string &path);
 
@@ -31,12 +39,25 @@ open_face(const std::string &path);
 ImgType
 merge_images(const images &images);
 
+/**
+ * @brief `n` indices below `count`, drawn with replacement from rng().
+ */
+std::vector<size_t>
+sample_indices(size_t count, size_t n);
+
 std::vector<std::unique_ptr<std::string>>
 sample_paths(const paths &ims, size_t n);
 
+/**
+ * @brief `n` faces drawn from `ims`, read from the image store of `ims` in CACHE_DIR (built on first use).
+ */
 images
 sample_faces(const paths &ims, size_t n);
 
+/**
+ * @brief `n` random square crops of the frames of `ims` (see StoreFrames), resized to FEATURE_SIZE unless `resize` is
+ * false. The frames come from the image store of `ims` in CACHE_DIR, built on first use.
+ */
 images
 sample_backgrounds(const paths &ims, size_t n, bool resize = true);
 
@@ -49,8 +70,10 @@ open_background(const std::string &path, bool resize = true);
 Samples
 sample_data(int n_faces, int n_bgs, const paths &faces, const paths &bgs);
 
-Samples
-sample_data(int n_faces, int n_bgs, const paths &faces, const paths &bgs, Stats stats);
+#define FNV_OFFSET 14695981039346656037ULL
 
-Stats
-compute_stats(const images &ims);
+/**
+ * @brief 64 bit FNV-1a hash of `n` bytes, chained from `hash`. Used to key caches on disk.
+ */
+uint64_t
+fnv1a(const void *data, size_t n, uint64_t hash = FNV_OFFSET);